@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Counts heap allocations and measures the peak RSS of a full run over a synthetic tree.
+# usage: bench/alloc.sh [pages] [average_page_size] [extra docbuilder options]
+#
+
+set -e
+
+PAGES=${1:-100000}
+SIZE=${2:-4096}
+shift 2 || true
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+gcc -O2 -shared -fPIC $ROOT/bench/malloc_count.c -o $WORK/malloc_count.so
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1), largest page $(find $CORPUS -type f -printf '%s\n' | sort -n | tail -1) bytes"
+
+LD_PRELOAD=$WORK/malloc_count.so $WORK/docbuilder --input=$CORPUS --output=$WORK/search.sql --base-url=https://example.com/docs/ --json --use-front-matter "$@" > /dev/null
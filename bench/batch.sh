@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Ingest time of the generated .sql file in sqlite3 with different --batch-rows values.
+# usage: bench/batch.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-4096}
+RUNS=${3:-3}
+BATCHES=${BATCHES:-"1 10 100 1000"}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+for rows in $BATCHES; do
+    # --json is left out: its escapes are meant to be decoded by the JSON request, not by sqlite3
+    $WORK/docbuilder --input=$CORPUS --output=$WORK/batch.sql --base-url=https://example.com/docs/ --use-transactions --strip-jsx --batch-rows=$rows > /dev/null
+    statements=$(grep -c '^INSERT' $WORK/batch.sql)
+    times=""
+    for i in $(seq $RUNS); do
+        rm -f $WORK/batch.db
+        start=$(date +%s%N)
+        sqlite3 $WORK/batch.db < $WORK/batch.sql
+        times+="$(( ($(date +%s%N) - start) / 1000000 )) "
+    done
+    best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+    echo "batch-rows=$rows: $statements statements, best ${best}ms (runs: $times)"
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Speed of the plain build used before the Makefile (no optimization level), of the release build
+# and of the release build trained with profile guided optimization, on a warm page cache.
+# usage: bench/build.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-8192}
+RUNS=${3:-5}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder-plain
+make -s -C $ROOT/src release TARGET=$WORK/docbuilder-release BUILD=$WORK/build
+make -s -C $ROOT/src pgo TARGET=$WORK/docbuilder-pgo BUILD=$WORK/build
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+# a different seed than the training corpus of the pgo build
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+run () {
+    local start=$(date +%s%N)
+    $1 --input=$CORPUS --output=$WORK/search.sql --base-url=https://example.com/docs/ --use-transactions --json --use-front-matter --strip-html --strip-jsx --threads=1 > /dev/null
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+plain=0
+for build in plain release pgo; do
+    run $WORK/docbuilder-$build > /dev/null
+    times=""
+    for i in $(seq $RUNS); do times+="$(run $WORK/docbuilder-$build) "; done
+    best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+    (( plain == 0 )) && plain=$best
+    echo "$build: best ${best}ms, $(( plain * 100 / (best > 0 ? best : 1) ))% of the plain build speed (runs: $times)"
+done
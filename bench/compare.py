@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+#
+# Compares two result files of bench/suite.sh and reports the measures that got worse by more than
+# the threshold: lower MB/s, more allocations or a larger peak RSS. Exits with 1 when there is one.
+# usage: bench/compare.py baseline.jsonl results.jsonl [--threshold=0.1]
+#
+
+import argparse, json, sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('baseline')
+parser.add_argument('results')
+parser.add_argument('--threshold', type=float, default=0.1, help='relative change reported as a regression')
+args = parser.parse_args()
+
+# measure and whether a higher value is better
+MEASURES = [('mb_s', True), ('allocations', False), ('peak_rss_kb', False)]
+
+def load(path):
+    with open(path) as f:
+        rows = [json.loads(line) for line in f if line.strip()]
+    return {(r.get('corpus', ''), r['bench'], r['flags']): r for r in rows}
+
+baseline, results = load(args.baseline), load(args.results)
+regressions = 0
+for key, row in sorted(results.items()):
+    base = baseline.get(key)
+    if not base:
+        continue
+    for measure, higher in MEASURES:
+        if measure not in row or measure not in base or base[measure] == 0:
+            continue
+        change = (row[measure] - base[measure]) / base[measure]
+        worse = -change if higher else change
+        mark = 'REGRESSION' if worse > args.threshold else ''
+        regressions += bool(mark)
+        print('%-6s %-10s %-52s %-12s %12.2f -> %12.2f %+7.1f%% %s' % (key[0], key[1], key[2], measure, base[measure], row[measure], change * 100, mark))
+
+print('%d regressions' % regressions)
+sys.exit(1 if regressions else 0)
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Size and time of the sql file written with each --compress level, checked against the uncompressed
+# output decoded with gzip -dc or zstd -dc. zstd is left out when its header or its tool is not installed.
+# usage: bench/compress.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-4096}
+RUNS=${3:-3}
+LEVELS=${LEVELS:-"none gzip:1 gzip:6 gzip:9 zstd:1 zstd:3 zstd:9 zstd:15"}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+ZSTD="-DENABLE_ZSTD=1 -lzstd"
+echo '#include <zstd.h>' | gcc $CFLAGS -E - > /dev/null 2>&1 && command -v zstd > /dev/null || ZSTD=""
+gcc -O2 -pthread $CFLAGS -DENABLE_GZIP=1 $ROOT/src/main.c $ROOT/src/cargs.c $LDFLAGS -lz $ZSTD -o $WORK/docbuilder-compress
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE --front-matter=90 --code=15
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+run () {
+    local start=$(date +%s%N)
+    $WORK/docbuilder-compress --input=$CORPUS --output=$1 --base-url=https://example.com/docs/ --json --use-front-matter --use-transactions --sort "${@:2}" > /dev/null
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+run $WORK/compress.sql > /dev/null
+plain=$(stat -c %s $WORK/compress.sql)
+
+for level in $LEVELS; do
+    format=${level%%:*}
+    [[ $format == zstd && -z $ZSTD ]] && continue
+    args="" out=$WORK/compress.sql
+    [[ $format != none ]] && args="--compress=$level" out=$WORK/compress-out.sql.$format
+    times=""
+    for i in $(seq $RUNS); do times+="$(run $out $args) "; done
+    best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+    
+    size=$(stat -c %s $out)
+    result=OK
+    if [[ $format == gzip ]]; then cmp -s <(gzip -dc $out) $WORK/compress.sql || result=DIFFERENT
+    elif [[ $format == zstd ]]; then cmp -s <(zstd -dcq $out) $WORK/compress.sql || result=DIFFERENT
+    fi
+    echo "$level: $size bytes, ratio $(awk "BEGIN {printf \"%.2f\", $plain / $size}"), best ${best}ms (runs: $times) $result"
+done
@@ -0,0 +1,316 @@
+//
+//  corpus.c
+//  docbuilder
+//
+//  Deterministic generator of synthetic md/mdx documentation trees used by the benchmarks.
+//
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "../src/cargs.h"
+
+#define PATH_SEPARATOR              '/'
+
+static uint64_t seed = 1;
+
+typedef enum {
+    SIZE_SKEWED,                    // most pages are small, a few are much larger than the average
+    SIZE_UNIFORM,                   // between half and one and a half times the average
+    SIZE_FIXED                      // every page has the average size
+} size_distribution;
+
+typedef struct {
+    size_distribution   distribution;
+    int                 front_matter;   // % of pages with a front matter
+    int                 code;           // % of blocks that are fenced code blocks
+    int                 jsx;            // % of blocks that are JSX components or expressions
+    int                 html;           // % of blocks that are plain HTML
+} corpus_mix;
+
+static corpus_mix mix = {SIZE_SKEWED, 100, 10, 10, 0};
+
+static const char *words[] = {
+    "the", "sqlite", "cloud", "database", "query", "index", "table", "search", "documentation", "node",
+    "cluster", "replica", "transaction", "statement", "column", "row", "schema", "client", "server", "api",
+    "connection", "string", "result", "value", "function", "returns", "using", "with", "from", "into",
+    "a", "an", "is", "of", "to", "in", "and", "for", "on", "by"
+};
+
+// MARK: - Random -
+
+// xorshift64*, the same seed always generates the same tree
+static uint64_t random_next (void) {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 0x2545F4914F6CDD1DULL;
+}
+
+static size_t random_range (size_t min, size_t max) {
+    return min + (size_t)(random_next() % (max - min + 1));
+}
+
+static const char *random_word (void) {
+    return words[random_next() % (sizeof(words) / sizeof(words[0]))];
+}
+
+// MARK: - Generator -
+
+static void write_paragraph (FILE *f) {
+    size_t nwords = random_range(20, 120);
+    for (size_t i = 0; i < nwords; ++i) {
+        size_t kind = random_range(0, 99);
+        if (kind < 2) fprintf(f, "[%s](https://sqlitecloud.io/%s) ", random_word(), random_word());
+        else if (kind < 4) fprintf(f, "**%s** ", random_word());
+        else if (kind < 5) fprintf(f, "`%s()` ", random_word());
+        else if (kind < 6) fprintf(f, "it's ");
+        else if (kind < 7) fprintf(f, "\"%s\" ", random_word());
+        else fprintf(f, "%s ", random_word());
+    }
+    fprintf(f, "\n\n");
+}
+
+static void write_page (FILE *f, size_t index, size_t target_size) {
+    if ((int)random_range(0, 99) < mix.front_matter) {
+        fprintf(f, "---\ntitle: \"Page %zu %s\"\ndescription: %s %s %s\nslug: docs/page-%zu\n---\n", index, random_word(), random_word(), random_word(), random_word(), index);
+    }
+    if (mix.jsx > 0 && random_range(0, 3) == 0) fprintf(f, "import Callout from \"@components/Callout.astro\";\n\n");
+    
+    while ((size_t)ftell(f) < target_size) {
+        int kind = (int)random_range(0, 99);
+        if (kind < 10) {
+            fprintf(f, "## %s %s\n\n", random_word(), random_word());
+        } else if ((kind -= 10) < mix.code) {
+            fprintf(f, "```sql\nSELECT * FROM %s WHERE %s = 'x';\n```\n\n", random_word(), random_word());
+        } else if ((kind -= mix.code) < mix.jsx) {
+            if (kind % 2) fprintf(f, "<Callout type=\"note\">\n%s %s\n</Callout>\n\n", random_word(), random_word());
+            else fprintf(f, "The %s is {props.%s} and {frontmatter.%s}.\n\n", random_word(), random_word(), random_word());
+        } else if ((kind -= mix.jsx) < mix.html) {
+            fprintf(f, "<div class=\"%s\"><b>%s</b> %s<br/></div>\n\n", random_word(), random_word(), random_word());
+        } else {
+            write_paragraph(f);
+        }
+    }
+}
+
+static size_t page_size (size_t average) {
+    if (mix.distribution == SIZE_FIXED) return average;
+    if (mix.distribution == SIZE_UNIFORM) return random_range(average / 2, average + average / 2);
+    
+    size_t kind = random_range(0, 9);
+    if (kind < 6) return random_range(average / 4, average);
+    if (kind < 9) return random_range(average, average * 2);
+    return random_range(average * 2, average * 8);
+}
+
+static void generate (const char *root, size_t npages, size_t average, size_t depth) {
+    char path[4096];
+    
+    for (size_t i = 0; i < npages; ++i) {
+        // pages are spread in a tree of 10 folders per level
+        int len = snprintf(path, sizeof(path), "%s", root);
+        mkdir(path, 0755);
+        size_t folder = i;
+        for (size_t d = 0; d < depth; ++d) {
+            len += snprintf(path + len, sizeof(path) - len, "%cs%zu", PATH_SEPARATOR, folder % 10);
+            mkdir(path, 0755);
+            folder /= 10;
+        }
+        snprintf(path + len, sizeof(path) - len, "%cpage%zu.%s", PATH_SEPARATOR, i, (i % 3) ? "md" : "mdx");
+        
+        FILE *f = fopen(path, "w");
+        if (!f) {
+            printf("Unable to create file %s.\n", path);
+            exit(-2);
+        }
+        write_page(f, i, page_size(average));
+        fclose(f);
+    }
+}
+
+// MARK: - Evict -
+
+// drops the pages of every file in the tree from the page cache to simulate a cold CI runner
+static void evict (const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+    
+    struct dirent *d;
+    char path[4096];
+    while ((d = readdir(dir))) {
+        if (d->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s%c%s", dir_path, PATH_SEPARATOR, d->d_name);
+        
+        struct stat sb;
+        if (lstat(path, &sb) < 0) continue;
+        if (S_ISDIR(sb.st_mode)) {
+            evict(path);
+            continue;
+        }
+        
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    closedir(dir);
+}
+
+// MARK: -
+
+int main (int argc, char * argv[]) {
+    static struct cag_option options[] = {
+        {
+            .identifier = 'o',
+            .access_letters = "o",
+            .access_name = "output",
+            .value_name = "path",
+            .description = "Root folder of the generated tree"
+        },
+        
+        {
+            .identifier = 'n',
+            .access_letters = "n",
+            .access_name = "pages",
+            .value_name = "N",
+            .description = "Number of pages (default 1000)"
+        },
+        
+        {
+            .identifier = 's',
+            .access_letters = "s",
+            .access_name = "size",
+            .value_name = "BYTES",
+            .description = "Average page size (default 8192)"
+        },
+        
+        {
+            .identifier = 'd',
+            .access_letters = "d",
+            .access_name = "depth",
+            .value_name = "N",
+            .description = "Folder depth (default 2)"
+        },
+        
+        {
+            .identifier = 'D',
+            .access_letters = "D",
+            .access_name = "distribution",
+            .value_name = "skewed|uniform|fixed",
+            .description = "Distribution of the page sizes (default skewed)"
+        },
+        
+        {
+            .identifier = 'f',
+            .access_letters = "f",
+            .access_name = "front-matter",
+            .value_name = "PCT",
+            .description = "Percentage of pages with a front matter (default 100)"
+        },
+        
+        {
+            .identifier = 'c',
+            .access_letters = "c",
+            .access_name = "code",
+            .value_name = "PCT",
+            .description = "Percentage of fenced code blocks (default 10)"
+        },
+        
+        {
+            .identifier = 'j',
+            .access_letters = "j",
+            .access_name = "jsx",
+            .value_name = "PCT",
+            .description = "Percentage of JSX components and expressions, 0 also removes the imports (default 10)"
+        },
+        
+        {
+            .identifier = 'H',
+            .access_letters = "H",
+            .access_name = "html",
+            .value_name = "PCT",
+            .description = "Percentage of HTML blocks (default 0)"
+        },
+        
+        {
+            .identifier = 'r',
+            .access_letters = "r",
+            .access_name = "seed",
+            .value_name = "N",
+            .description = "Random seed (default 1)"
+        },
+        
+        {
+            .identifier = 'e',
+            .access_letters = "e",
+            .access_name = "evict",
+            .value_name = "path",
+            .description = "Drop every file in path from the page cache and exit"
+        },
+        
+        {
+            .identifier = 'h',
+            .access_letters = "h",
+            .access_name = "help",
+            .value_name = NULL,
+            .description = "Shows the command help"
+        },
+    };
+    
+    const char *output = NULL;
+    size_t npages = 1000, average = 8192, depth = 2;
+    
+    cag_option_context context;
+    cag_option_init(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
+    while (cag_option_fetch(&context)) {
+        const char *value = cag_option_get_value(&context);
+        switch (cag_option_get_identifier(&context)) {
+            case 'o': output = value; break;
+            case 'n': npages = (value) ? strtoull(value, NULL, 10) : npages; break;
+            case 's': average = (value) ? strtoull(value, NULL, 10) : average; break;
+            case 'd': depth = (value) ? strtoull(value, NULL, 10) : depth; break;
+            case 'r': seed = (value) ? strtoull(value, NULL, 10) : seed; break;
+            case 'f': mix.front_matter = (value) ? atoi(value) : mix.front_matter; break;
+            case 'c': mix.code = (value) ? atoi(value) : mix.code; break;
+            case 'j': mix.jsx = (value) ? atoi(value) : mix.jsx; break;
+            case 'H': mix.html = (value) ? atoi(value) : mix.html; break;
+            case 'D':
+                if (value && strcmp(value, "uniform") == 0) mix.distribution = SIZE_UNIFORM;
+                else if (value && strcmp(value, "fixed") == 0) mix.distribution = SIZE_FIXED;
+                else mix.distribution = SIZE_SKEWED;
+                break;
+            case 'e': if (value) evict(value); return EXIT_SUCCESS;
+                
+            case 'h':
+                printf("Usage: corpus [OPTION]...\n");
+                printf("Generates a deterministic synthetic md/mdx documentation tree.\n\n");
+                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+                return EXIT_SUCCESS;
+                
+            case '?':
+                cag_option_print_error(&context, stdout);
+                break;
+        }
+    }
+    
+    if (!output) {
+        printf("Missing --output path.\n");
+        return EXIT_FAILURE;
+    }
+    if (seed == 0) seed = 1;
+    if (mix.code + mix.jsx + mix.html > 90) {
+        printf("Code, JSX and HTML blocks can't be more than 90%% of the blocks (headings are 10%%).\n");
+        return EXIT_FAILURE;
+    }
+    
+    generate(output, npages, average, depth);
+    return 0;
+}
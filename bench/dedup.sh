@@ -0,0 +1,40 @@
+#!/bin/bash
+#
+# Versioned docs: the same generated tree copied in VERSIONS folders, indexed with and without --dedup.
+# Prints the build and load time, the database size and the results of a query matching almost every page.
+# usage: bench/dedup.sh [pages] [average_page_size] [versions]
+#
+
+set -e
+
+PAGES=${1:-5000}
+SIZE=${2:-4096}
+VERSIONS=${3:-3}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+TREE=$WORK/versions-$PAGES-$SIZE-$VERSIONS
+if [[ ! -d $TREE ]]; then
+    mkdir -p $TREE
+    for v in $(seq $VERSIONS); do cp -r $CORPUS $TREE/v$v; done
+fi
+echo "corpus: $VERSIONS versions of $PAGES pages, $(du -sh $TREE | cut -f1)"
+
+for flags in "" "--dedup"; do
+    rm -f $WORK/dedup.db
+    start=$(date +%s%N)
+    $WORK/docbuilder --input=$TREE --output=$WORK/dedup.sql --base-url=https://example.com/docs/ --use-transactions $flags > /dev/null
+    build=$(( ($(date +%s%N) - start) / 1000000 ))
+    start=$(date +%s%N)
+    sqlite3 $WORK/dedup.db < $WORK/dedup.sql
+    load=$(( ($(date +%s%N) - start) / 1000000 ))
+    rows=$(sqlite3 $WORK/dedup.db "SELECT count(*) FROM documentation WHERE documentation MATCH 'database'")
+    echo "${flags:-default}: build ${build}ms, load ${load}ms, $(( $(stat -c %s $WORK/dedup.db) / 1024 ))KB, $rows results for 'database'"
+done
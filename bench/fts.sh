@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Size, load time and query time of the FTS5 layouts selected by the --fts-* options.
+# usage: bench/fts.sh [pages] [average_page_size] [queries]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-4096}
+QUERIES=${3:-200}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+# one layout per line, the contentless layout needs sqlite3 3.43 or later. The front matter columns are also
+# checked on streamed pages (--stream-threshold=1), whose INSERT is written while the page is read
+LAYOUTS=${LAYOUTS:-"
+--fts-optimize
+--fts-unindexed=url --fts-optimize
+--fts-unindexed=url --fts-detail=column --fts-optimize
+--fts-unindexed=url --fts-detail=none --fts-columnsize=0 --fts-optimize
+--fts-unindexed=url --fts-prefix=2,3 --fts-optimize
+--fts-content=external --fts-unindexed=url --fts-optimize
+--fts-content=contentless --fts-unindexed=url --fts-optimize
+--fts-content=contentless --fts-unindexed=url --fts-detail=none --fts-optimize
+--use-front-matter --fts-front-matter=title,description --fts-weights=title:10 --fts-unindexed=url --fts-optimize
+--use-front-matter --fts-front-matter=title,description,slug,sidebar_position_x,another_long_column_name,yet_another_long_one --fts-weights=title:10 --stream-threshold=1 --fts-optimize"}
+
+# terms and prefixes only, phrase queries are not supported by detail=column|none
+rm -f $WORK/fts-queries.sql
+for i in $(seq $QUERIES); do
+    for q in lorem consectetur 'amet OR word' 'lo*' 'con*'; do
+        echo "SELECT rowid FROM documentation WHERE documentation MATCH '$q' ORDER BY rank LIMIT 10;" >> $WORK/fts-queries.sql
+    done
+done
+
+while read -r layout; do
+    [[ -z $layout ]] && continue
+    $WORK/docbuilder --input=$CORPUS --output=$WORK/fts.sql --base-url=https://example.com/docs/ --use-transactions --strip-jsx $layout > /dev/null
+    rm -f $WORK/fts.db
+    start=$(date +%s%N)
+    sqlite3 $WORK/fts.db < $WORK/fts.sql
+    load=$(( ($(date +%s%N) - start) / 1000000 ))
+    start=$(date +%s%N)
+    sqlite3 $WORK/fts.db < $WORK/fts-queries.sql > /dev/null
+    query=$(( ($(date +%s%N) - start) / 1000000 ))
+    echo "$layout: $(( $(stat -c %s $WORK/fts.db) / 1024 ))KB, load ${load}ms, $(( QUERIES * 5 )) queries ${query}ms"
+done <<< "$LAYOUTS"
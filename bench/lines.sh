@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Pathological pages for the line classification of the parser: the parse time must grow linearly with the
+# number of lines. Each case is timed with N, 2N and 4N lines, the time per line should stay flat.
+# usage: bench/lines.sh [lines] [runs]
+#
+
+set -e
+
+LINES=${1:-50000}
+RUNS=${2:-3}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}/lines
+rm -rf $WORK && mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+
+# import lines of an mdx page, all but the last one are not astro components
+imports () {
+    awk -v n=$1 'BEGIN { for (i = 0; i < n; i++) printf "import C%d from \"./c%d.js\";\n", i, i; print "import Last from \"./last.astro\";"; print "text" }'
+}
+
+# a long front matter followed by the status
+front_matter () {
+    awk -v n=$1 'BEGIN { print "---"; print "title: big"; for (i = 0; i < n; i++) printf "slot%d: value %d\n", i, i; print "status: published"; print "---"; print "text" }'
+}
+
+# a single line (a minified page) with one "imp" every few bytes and no astro import
+single_line () {
+    awk -v n=$1 'BEGIN { for (i = 0; i < n; i++) printf "important impact "; printf "import X from \"./x.js\"\n" }'
+}
+
+run () {
+    local best=""
+    for i in $(seq $RUNS); do
+        local start=$(date +%s%N)
+        $WORK/docbuilder --input=$WORK/$1 --output=$WORK/search.sql --base-url=https://example.com/docs/ --json --use-front-matter --strip-jsx > /dev/null
+        local elapsed=$(( ($(date +%s%N) - start) / 1000 ))
+        [[ -z $best || $elapsed -lt $best ]] && best=$elapsed
+    done
+    echo $best
+}
+
+# only the line of the astro import is removed: a short "imp" line before it is text (the first versions
+# looked for the end of the line 7 bytes after "imp", past its newline, and dropped it too)
+mkdir -p $WORK/short_line
+printf 'imp\nimport A from "./a.astro";\nhello\n' > $WORK/short_line/page.mdx
+$WORK/docbuilder --input=$WORK/short_line --output=$WORK/short_line.sql --base-url=https://example.com/docs/ --strip-jsx > /dev/null
+if ! grep -q "VALUES ('https://example.com/docs/page', 'imp$" $WORK/short_line.sql || grep -q "a.astro" $WORK/short_line.sql; then
+    echo "short_line: wrong output"
+    cat $WORK/short_line.sql
+    exit 1
+fi
+echo "short_line: OK"
+
+for kind in imports front_matter single_line; do
+    for scale in 1 2 4; do
+        n=$((LINES * scale))
+        mkdir -p $WORK/$kind-$n
+        $kind $n > $WORK/$kind-$n/page.mdx
+        us=$(run $kind-$n)
+        unit=line
+        [[ $kind == single_line ]] && unit=imp
+        echo "$kind: $n ${unit}s, $((us / 1000))ms, $((us * 1000 / n))ns/$unit"
+    done
+done
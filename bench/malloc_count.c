@@ -0,0 +1,43 @@
+//
+//  malloc_count.c
+//  docbuilder
+//
+//  LD_PRELOAD shim that counts the heap allocations of a process and prints them,
+//  together with its peak RSS, to stderr when the process exits.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t count, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static atomic_size_t nallocs = 0;
+static atomic_size_t nbytes = 0;
+
+void *malloc (size_t size) {
+    atomic_fetch_add_explicit(&nallocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&nbytes, size, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc (size_t count, size_t size) {
+    atomic_fetch_add_explicit(&nallocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&nbytes, count * size, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc (void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&nallocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&nbytes, size, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor)) static void malloc_count_report (void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "allocations=%zu allocated_bytes=%zu peak_rss_kb=%ld\n", (size_t)nallocs, (size_t)nbytes, usage.ru_maxrss);
+}
@@ -0,0 +1,223 @@
+//
+//  micro.c
+//  docbuilder
+//
+//  Measures the phases of the docbuilder in isolation (directory walk, process_md and process_json)
+//  over a tree already loaded in memory, one JSON object per line on stdout.
+//
+
+// the static functions of the docbuilder are benchmarked directly
+#define main docbuilder_main
+#include "../src/main.c"
+#undef main
+
+typedef struct {
+    const char  *name;
+    bool        strip_html;
+    bool        strip_jsx;
+    bool        use_front_matter;
+    bool        json_mode;
+} bench_flags;
+
+static const bench_flags flag_sets[] = {
+    {"none",                false, false, false, false},
+    {"--strip-html",        true,  false, false, false},
+    {"--strip-jsx",         false, true,  false, false},
+    {"--use-front-matter",  false, false, true,  false},
+    {"--json",              false, false, false, true},
+    {"all",                 true,  true,  true,  true},
+};
+
+typedef struct {
+    char    **sources;
+    size_t  *sizes;
+    size_t  count;
+    size_t  bytes;
+} bench_tree;
+
+// MARK: - Utils -
+
+static double bench_now (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_report (const char *bench, const char *flags, size_t files, size_t bytes, double seconds) {
+    printf("{\"bench\": \"%s\", \"flags\": \"%s\", \"files\": %zu, \"bytes\": %zu, \"seconds\": %.6f, \"mb_s\": %.2f, \"files_s\": %.1f}\n",
+           bench, flags, files, bytes, seconds, (double)bytes / 1048576.0 / seconds, (double)files / seconds);
+    fflush(stdout);
+}
+
+static void bench_options (const bench_flags *flags, docbuilder_options *options) {
+    // the same derived options computed by the docbuilder main
+    memset(options, 0, sizeof(docbuilder_options));
+    options->strip_html = flags->strip_html;
+    options->strip_jsx = flags->strip_jsx;
+    options->use_front_matter = flags->use_front_matter;
+    options->json_mode = flags->json_mode;
+    options->nthreads = 1;
+    options->sql_escape = true;
+    options->json_escape = flags->json_mode;
+}
+
+static void bench_load (const doc_list *list, bench_tree *tree) {
+    tree->sources = (char **)calloc(list->count, sizeof(char *));
+    tree->sizes = (size_t *)calloc(list->count, sizeof(size_t));
+    if (!tree->sources || !tree->sizes) exit(-3);
+    
+    for (size_t i = 0; i < list->count; ++i) {
+        struct stat sb;
+        tree->sources[tree->count] = file_read(list->paths[i], &tree->sizes[tree->count], &sb);
+        if (!tree->sources[tree->count]) continue;
+        tree->bytes += tree->sizes[tree->count++];
+    }
+}
+
+// MARK: - Benchmarks -
+
+static void bench_walk (const char *root, int runs, doc_list *list) {
+    docbuilder_options options = {0};
+    scratch_buffer path = {0};
+    size_t path_len = strlen(root);
+    double best = 0;
+    
+    for (int r = 0; r < runs; ++r) {
+        doc_list_free(list);
+        memcpy(scratch_reserve(&path, path_len + 1), root, path_len + 1);
+        
+        double start = bench_now();
+        scan_docs(&options, NULL, list, NULL, &path, path_len);
+        double elapsed = bench_now() - start;
+        if (r == 0 || elapsed < best) best = elapsed;
+    }
+    
+    size_t bytes = 0;
+    for (size_t i = 0; i < list->count; ++i) bytes += strlen(list->paths[i]);
+    bench_report("walk", "none", list->count, bytes, best);
+    scratch_free(&path);
+}
+
+static void bench_parse (const bench_tree *tree, const bench_flags *flags, int runs) {
+    docbuilder_options options;
+    bench_options(flags, &options);
+    file_scratch scratch = {0};
+    double best_md = 0, best_json = 0;
+    size_t header_bytes = 0, nheaders = 0;
+    
+    for (int r = 0; r < runs; ++r) {
+        double md = 0, json = 0;
+        header_bytes = nheaders = 0;
+        
+        for (size_t i = 0; i < tree->count; ++i) {
+            size_t size = tree->sizes[i];
+            char *buffer = scratch_reserve(&scratch.buffer, size * 2 + 1);
+            scratch_reserve(&scratch.header, size + 1);
+            
+            md_parser parser;
+            md_parser_init(&parser, &scratch.header, &scratch.slug);
+            double start = bench_now();
+            process_md(&options, &parser, tree->sources[i], size, true, buffer, &size);
+            md += bench_now() - start;
+            
+            if (!OPTIONS_COL(&options) || parser.is_draft) continue;
+            size_t header_size = parser.header_len;
+            header_bytes += header_size;
+            ++nheaders;
+            start = bench_now();
+            process_json(&options, parser.header->data, &scratch.json, &header_size);
+            json += bench_now() - start;
+        }
+        if (r == 0 || md < best_md) best_md = md;
+        if (r == 0 || json < best_json) best_json = json;
+    }
+    
+    bench_report("process_md", flags->name, tree->count, tree->bytes, best_md);
+    if (header_bytes) bench_report("process_json", flags->name, nheaders, header_bytes, best_json);
+    file_scratch_free(&scratch);
+}
+
+// MARK: -
+
+int main (int argc, char * argv[]) {
+    static struct cag_option options[] = {
+        {
+            .identifier = 'i',
+            .access_letters = "i",
+            .access_name = "input",
+            .value_name = "path",
+            .description = "Root folder of the md/mdx tree"
+        },
+        
+        {
+            .identifier = 'r',
+            .access_letters = "r",
+            .access_name = "runs",
+            .value_name = "N",
+            .description = "Runs of each benchmark, the best one is reported (default 3)"
+        },
+        
+        {
+            .identifier = 'S',
+            .access_letters = "S",
+            .access_name = "simd",
+            .value_name = "auto|avx2|sse2|scalar",
+            .description = "Instruction set of the text scanner (default auto)"
+        },
+        
+        {
+            .identifier = 'h',
+            .access_letters = "h",
+            .access_name = "help",
+            .value_name = NULL,
+            .description = "Shows the command help"
+        },
+    };
+    
+    const char *input = NULL, *simd = NULL;
+    int runs = 3;
+    
+    cag_option_context context;
+    cag_option_init(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
+    while (cag_option_fetch(&context)) {
+        const char *value = cag_option_get_value(&context);
+        switch (cag_option_get_identifier(&context)) {
+            case 'i': input = value; break;
+            case 'r': runs = (value) ? atoi(value) : runs; break;
+            case 'S': simd = value; break;
+            
+            case 'h':
+                printf("Usage: micro [OPTION]...\n");
+                printf("Benchmarks the phases of the docbuilder, one JSON object per line.\n\n");
+                cag_option_print(options, CAG_ARRAY_SIZE(options), stdout);
+                return EXIT_SUCCESS;
+            
+            case '?':
+                cag_option_print_error(&context, stdout);
+                break;
+        }
+    }
+    
+    if (!input) {
+        printf("Missing --input path.\n");
+        return EXIT_FAILURE;
+    }
+    if (runs <= 0) runs = 1;
+    if (!md_scanner_init(simd)) {
+        printf("Unsupported SIMD instruction set: %s.\n", simd);
+        return EXIT_FAILURE;
+    }
+    
+    doc_list list = {0};
+    bench_walk(input, runs, &list);
+    
+    bench_tree tree = {0};
+    bench_load(&list, &tree);
+    for (size_t i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]); ++i) bench_parse(&tree, &flag_sets[i], runs);
+    
+    for (size_t i = 0; i < tree.count; ++i) free(tree.sources[i]);
+    free(tree.sources);
+    free(tree.sizes);
+    doc_list_free(&list);
+    return 0;
+}
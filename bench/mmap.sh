@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Compares the default read() input path with --mmap on a warm and on a cold page cache.
+# usage: bench/mmap.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-16384}
+RUNS=${3:-5}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+run () {
+    local start=$(date +%s%N)
+    $WORK/docbuilder --input=$CORPUS --output=$WORK/search.sql --base-url=https://example.com/docs/ --json --use-front-matter "$@" > /dev/null
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+for cache in warm cold; do
+    for mode in read mmap; do
+        args=""
+        [[ $mode == mmap ]] && args="--mmap"
+        [[ $cache == warm ]] && run $args > /dev/null
+        times=""
+        for i in $(seq $RUNS); do
+            [[ $cache == cold ]] && $WORK/corpus --evict=$CORPUS
+            times+="$(run $args) "
+        done
+        best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+        echo "$cache $mode: best ${best}ms (runs: $times)"
+    done
+done
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+#
+# Query latency of the generated index: builds the sql file of each configuration, loads it in a fresh
+# sqlite database and replays a workload of FTS5 queries (terms, AND, prefixes, phrases, bm25 ranking,
+# snippet, highlight, autocomplete, a title column), then reports p50/p95/p99 of each query, the load time and the size
+# of the index. Two or more --config are compared in the same run against the first one (A/B), with the
+# same sampled words. The words are sampled from the index of the first configuration (fts5vocab), the
+# phrases from the text of its rows: common, medium and rare terms in the same proportion.
+# usage: bench/query.py --docbuilder=./main --input=docs --config="" --config="--strip-html" [--samples=200]
+#        [--workload=queries.tsv] [--results=query.jsonl]
+#
+# A workload file has a query on each line, its name and the sql separated by a tab, the named parameters
+# :term, :term2, :prefix and :phrase are bound to the sampled words (already quoted for MATCH), :letters
+# to the first two letters of :term. The configurations must not use --json or the weblite formats, their
+# escapes are decoded by the json request, not by sqlite. Like bench/fts.sh, the contentless layout needs
+# the sqlite of python to be 3.43 or later.
+#
+
+import argparse, gzip, json, os, random, shlex, sqlite3, subprocess, sys, tempfile, time
+
+WORKLOAD = [
+    ('term',         "SELECT url FROM documentation WHERE documentation MATCH :term LIMIT 10"),
+    ('and',          "SELECT url FROM documentation WHERE documentation MATCH :term || ' AND ' || :term2 LIMIT 10"),
+    ('prefix',       "SELECT url FROM documentation WHERE documentation MATCH :prefix LIMIT 10"),
+    ('phrase',       "SELECT url FROM documentation WHERE documentation MATCH :phrase LIMIT 10"),
+    ('rank',         "SELECT url FROM documentation WHERE documentation MATCH :term ORDER BY rank LIMIT 10"),
+    ('bm25',         "SELECT url FROM documentation WHERE documentation MATCH :term ORDER BY bm25(documentation) LIMIT 10"),
+    ('prefix-rank',  "SELECT url FROM documentation WHERE documentation MATCH :prefix ORDER BY rank LIMIT 10"),
+    ('snippet',      "SELECT url, snippet(documentation, -1, '<b>', '</b>', '...', 16) FROM documentation WHERE documentation MATCH :term ORDER BY rank LIMIT 10"),
+    ('highlight',    "SELECT url, highlight(documentation, 1, '<b>', '</b>') FROM documentation WHERE documentation MATCH :term ORDER BY rank LIMIT 10"),
+    ('autocomplete', "SELECT term, url FROM documentation_autocomplete WHERE prefix2 = :letters ORDER BY score DESC LIMIT 10"),
+    ('title',        "SELECT url FROM documentation WHERE documentation MATCH '{title} : ' || :term ORDER BY rank LIMIT 10"),
+]
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--docbuilder', required=True)
+parser.add_argument('--input', required=True)
+parser.add_argument('--config', action='append', required=True, help='builder options of a configuration, the first one is the baseline')
+parser.add_argument('--base-url', default='https://example.com/docs/')
+parser.add_argument('--workload', help='tab separated name and sql of each query, the default workload otherwise')
+parser.add_argument('--samples', type=int, default=200, help='different words for each query')
+parser.add_argument('--runs', type=int, default=3, help='times each query is run, the fastest one is kept')
+parser.add_argument('--seed', type=int, default=1)
+parser.add_argument('--work', default=os.environ.get('BENCH_DIR', tempfile.gettempdir()))
+parser.add_argument('--results', help='append a json line for each query of each configuration')
+args = parser.parse_args()
+
+workload = WORKLOAD
+if args.workload:
+    with open(args.workload) as f:
+        workload = [tuple(line.rstrip('\n').split('\t', 1)) for line in f if line.strip() and not line.startswith('#')]
+
+
+def build(index, config):
+    sql = os.path.join(args.work, 'query-%d.sql' % index)
+    db = os.path.join(args.work, 'query-%d.db' % index)
+    cmd = [args.docbuilder, '--input=' + args.input, '--output=' + sql, '--base-url=' + args.base_url] + shlex.split(config)
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+    if os.path.exists(db):
+        os.remove(db)
+
+    # a --compress=gzip file is decoded first
+    with open(sql, 'rb') as f:
+        data = f.read()
+    if data[:2] == b'\x1f\x8b':
+        data = gzip.decompress(data)
+    start = time.perf_counter()
+    conn = sqlite3.connect(db, isolation_level=None)
+    try:
+        conn.executescript(data.decode('utf-8', 'replace'))
+    except sqlite3.Error as e:
+        sys.exit('"%s": the sql file can\'t be loaded (%s, sqlite %s)' % (config, e, sqlite3.sqlite_version))
+    load_ms = (time.perf_counter() - start) * 1e3
+    size = os.path.getsize(db)
+    index_size = conn.execute("SELECT coalesce(sum(pgsize), 0) FROM dbstat WHERE name LIKE 'documentation%'").fetchone()[0]
+    return conn, load_ms, size, index_size
+
+
+def quote(word):
+    return '"' + word.replace('"', '""') + '"'
+
+
+# common, medium and rare terms of the first index, two consecutive words of its rows for the phrases
+def sample(conn):
+    rng = random.Random(args.seed)
+    conn.execute("CREATE VIRTUAL TABLE temp.query_vocab USING fts5vocab(main, documentation, 'row')")
+    terms = [t for t, in conn.execute("SELECT term FROM temp.query_vocab WHERE length(term) > 2 ORDER BY doc DESC")]
+    if len(terms) < 3:
+        sys.exit('the index has too few terms')
+    third = len(terms) // 3
+    pick = lambda: terms[rng.choice((0, third, 2 * third)) + rng.randrange(third)]
+
+    texts = [t for t, in conn.execute("SELECT content FROM documentation WHERE rowid IN (SELECT rowid FROM documentation ORDER BY random() LIMIT 500)") if t]
+    samples = []
+    for _ in range(args.samples):
+        term, term2 = pick(), pick()
+        words = [w for w in rng.choice(texts).split() if w.isalnum()] if texts else []
+        k = rng.randrange(len(words) - 1) if len(words) > 1 else 0
+        phrase = ' '.join(words[k:k + 2]) if len(words) > 1 else term + ' ' + term2
+        samples.append({'term': quote(term), 'term2': quote(term2), 'prefix': quote(term[:2]) + '*', 'letters': term[:2], 'phrase': quote(phrase)})
+    return samples
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+
+def replay(conn, samples):
+    results = {}
+    for name, sql in workload:
+        times, rows = [], 0
+        try:
+            conn.execute(sql, samples[0]).fetchall()
+            for params in samples:
+                best = None
+                for _ in range(args.runs):
+                    start = time.perf_counter_ns()
+                    found = conn.execute(sql, params).fetchall()
+                    elapsed = (time.perf_counter_ns() - start) / 1e3
+                    best = elapsed if best is None or elapsed < best else best
+                times.append(best)
+                rows += len(found)
+        except sqlite3.Error as e:
+            # phrases need detail=full, snippet and highlight the content, autocomplete its table, title --fts-front-matter=title
+            results[name] = {'error': str(e)}
+            continue
+        results[name] = {'p50_us': percentile(times, 50), 'p95_us': percentile(times, 95), 'p99_us': percentile(times, 99), 'rows': rows / len(times)}
+    return results
+
+
+configs, samples = [], None
+for i, config in enumerate(args.config):
+    conn, load_ms, size, index_size = build(i, config)
+    if samples is None:
+        samples = sample(conn)
+    configs.append({'config': config, 'load_ms': load_ms, 'db_kb': size // 1024, 'index_kb': index_size // 1024, 'queries': replay(conn, samples)})
+    conn.close()
+
+for i, c in enumerate(configs):
+    print('%s: "%s" load %.0fms, database %dKB, index %dKB' % (chr(ord('A') + i), c['config'], c['load_ms'], c['db_kb'], c['index_kb']))
+print('\n%-14s' % 'query' + ''.join('%28s' % ('%s p50/p95/p99 us' % chr(ord('A') + i)) for i in range(len(configs))) + ('%16s' % 'p50 vs A' if len(configs) > 1 else ''))
+for name, _ in workload:
+    line = '%-14s' % name
+    for c in configs:
+        q = c['queries'][name]
+        line += '%28s' % ('n/a' if 'error' in q else '%.0f / %.0f / %.0f' % (q['p50_us'], q['p95_us'], q['p99_us']))
+    base = configs[0]['queries'][name]
+    for c in configs[1:]:
+        q = c['queries'][name]
+        if 'error' not in q and 'error' not in base and base['p50_us'] > 0:
+            line += '%+15.1f%%' % ((q['p50_us'] - base['p50_us']) / base['p50_us'] * 100)
+    print(line)
+
+if args.results:
+    with open(args.results, 'a') as f:
+        for c in configs:
+            for name, q in c['queries'].items():
+                f.write(json.dumps(dict({'bench': 'query', 'config': c['config'], 'query': name, 'load_ms': c['load_ms'], 'index_kb': c['index_kb']}, **q)) + '\n')
@@ -0,0 +1,26 @@
+#!/bin/bash
+#
+# A/B query latency of two builder configurations on a generated corpus, see bench/query.py.
+# usage: bench/query.sh [pages] [average_page_size] [samples]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-4096}
+SAMPLES=${3:-200}
+A=${A:-"--use-transactions --strip-jsx"}
+B=${B:-"--use-transactions --strip-jsx --strip-html --strip-md-titles --fts-prefix=2,3 --fts-optimize"}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+python3 $ROOT/bench/query.py --docbuilder=$WORK/docbuilder --input=$CORPUS --work=$WORK --samples=$SAMPLES --config="$A" --config="$B" "${@:4}"
@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Time of the whole run on a cold and on a warm page cache, with the parsers reading the files and
+# with --read-ahead. The cache is dropped with /proc/sys/vm/drop_caches when it is writable (root),
+# otherwise the files are evicted one by one (the directories and the inodes stay cached).
+# usage: bench/readahead.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-20000}
+SIZE=${2:-4096}
+RUNS=${3:-5}
+THREADS=${THREADS:-"1 4"}
+DEPTHS=${DEPTHS:-"0 8 32 128"}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+evict () {
+    if [[ -w /proc/sys/vm/drop_caches ]]; then
+        sync && echo 3 > /proc/sys/vm/drop_caches
+    else
+        $WORK/corpus --evict=$CORPUS
+    fi
+}
+
+run () {
+    local start=$(date +%s%N)
+    $WORK/docbuilder --input=$CORPUS --output=$WORK/search.sql --base-url=https://example.com/docs/ --json --use-front-matter "$@" > /dev/null
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+for cache in cold warm; do
+    for threads in $THREADS; do
+        for depth in $DEPTHS; do
+            args="--threads=$threads --read-ahead=$depth"
+            [[ $cache == warm ]] && run $args > /dev/null
+            times=""
+            for i in $(seq $RUNS); do
+                [[ $cache == cold ]] && evict
+                times+="$(run $args) "
+            done
+            best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+            echo "$cache threads=$threads read-ahead=$depth: best ${best}ms (runs: $times)"
+        done
+    done
+done
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Parser throughput (MB/s on a warm page cache) with the scalar loop and with each vectorized text scanner.
+# usage: bench/simd.sh [pages] [average_page_size] [runs]
+#
+
+set -e
+
+PAGES=${1:-2000}
+SIZE=${2:-131072}
+RUNS=${3:-5}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+BYTES=$(find $CORPUS -type f -name '*.md*' -printf '%s\n' | awk '{s+=$1} END {print s}')
+echo "corpus: $PAGES pages, $((BYTES / 1048576))MB"
+
+run () {
+    local start=$(date +%s%N)
+    $WORK/docbuilder --input=$CORPUS --output=$WORK/search.sql --base-url=https://example.com/docs/ --json --use-front-matter --strip-jsx --strip-html "$@" > /dev/null || return 1
+    echo $(( ($(date +%s%N) - start) / 1000000 ))
+}
+
+for simd in scalar sse2 avx2; do
+    if ! run --simd=$simd > /dev/null 2>&1; then
+        echo "$simd: not supported"
+        continue
+    fi
+    cp $WORK/search.sql $WORK/search-$simd.sql
+    times=""
+    for i in $(seq $RUNS); do times+="$(run --simd=$simd) "; done
+    best=$(echo $times | tr ' ' '\n' | sort -n | head -1)
+    echo "$simd: best ${best}ms, $(( BYTES * 1000 / 1048576 / (best > 0 ? best : 1) ))MB/s (runs: $times)"
+    cmp -s $WORK/search-scalar.sql $WORK/search-$simd.sql || echo "$simd: output differs from scalar"
+done
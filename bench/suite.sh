@@ -0,0 +1,68 @@
+#!/bin/bash
+#
+# End-to-end benchmark suite: generates a few deterministic corpora, measures each phase in isolation
+# (bench/micro.c) and full runs for every flag combination, with heap allocations and peak RSS.
+# Every result is a JSON object on its own line, compare two result files with bench/compare.py.
+# usage: bench/suite.sh [results.jsonl] [runs]
+#
+
+set -e
+
+RESULTS=${1:-results.jsonl}
+RUNS=${2:-3}
+SCALE=${SCALE:-1}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+gcc -O2 -pthread $ROOT/src/main.c $ROOT/src/cargs.c -o $WORK/docbuilder
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+gcc -O2 -pthread $ROOT/bench/micro.c $ROOT/src/cargs.c -o $WORK/micro
+gcc -O2 -shared -fPIC $ROOT/bench/malloc_count.c -o $WORK/malloc_count.so
+
+# name, pages and corpus options
+CORPORA=(
+    "docs       5000    --size=8192"
+    "small      50000   --size=1024 --distribution=uniform --depth=4"
+    "large      200     --size=262144 --distribution=fixed"
+    "mdx        5000    --size=8192 --jsx=30 --html=20 --code=20"
+    "plain      5000    --size=8192 --front-matter=0 --jsx=0 --code=0"
+)
+
+FLAGS=(
+    ""
+    "--strip-html"
+    "--strip-jsx"
+    "--use-front-matter"
+    "--json"
+    "--strip-html --strip-jsx --use-front-matter --json"
+)
+
+: > $RESULTS
+for corpus in "${CORPORA[@]}"; do
+    read -r name pages args <<< "$corpus"
+    pages=$((pages * SCALE))
+    CORPUS=$WORK/suite-$name-$pages
+    [[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$pages $args
+    BYTES=$(find $CORPUS -type f -name '*.md*' -printf '%s\n' | awk '{s+=$1} END {print s}')
+    echo "corpus $name: $pages pages, $((BYTES / 1048576))MB" >&2
+    
+    $WORK/micro --input=$CORPUS --runs=$RUNS | sed "s/^{/{\"corpus\": \"$name\", /" | tee -a $RESULTS
+    
+    for flags in "${FLAGS[@]}"; do
+        best=0
+        for i in $(seq $RUNS); do
+            start=$(date +%s%N)
+            stats=$(LD_PRELOAD=$WORK/malloc_count.so $WORK/docbuilder --input=$CORPUS --output=$WORK/suite.sql --base-url=https://example.com/docs/ $flags 2>&1 >/dev/null | tail -1)
+            elapsed=$(( $(date +%s%N) - start ))
+            (( best == 0 || elapsed < best )) && best=$elapsed
+        done
+        # allocations=N allocated_bytes=N peak_rss_kb=N of the last run
+        read -r allocations allocated peak <<< "$(echo $stats | sed 's/[a-z_]*=//g')"
+        awk -v c=$name -v f="${flags:-none}" -v n=$pages -v b=$BYTES -v ns=$best -v a=$allocations -v ab=$allocated -v rss=$peak -v out=$(stat -c %s $WORK/suite.sql) 'BEGIN {
+            s = ns / 1e9
+            printf "{\"corpus\": \"%s\", \"bench\": \"full\", \"flags\": \"%s\", \"files\": %d, \"bytes\": %d, \"seconds\": %.6f, \"mb_s\": %.2f, \"files_s\": %.1f, \"output_bytes\": %d, \"allocations\": %d, \"allocated_bytes\": %d, \"peak_rss_kb\": %d}\n", c, f, n, b, s, b / 1048576 / s, n / s, out, a, ab, rss
+        }' | tee -a $RESULTS
+    done
+done
@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# Runs --upload against bench/weblite_mock.py with latency, errors and dropped connections and checks
+# that every scenario leaves the same rows as a clean upload. Prints the upload time of each scenario.
+# The compressed scenarios check that the gzip and zstd bodies decode to the same statements.
+# usage: bench/upload.sh [pages] [average_page_size]
+#
+
+set -e
+
+PAGES=${1:-2000}
+SIZE=${2:-4096}
+PORT=${PORT:-8181}
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORK=${BENCH_DIR:-/tmp/docbuilder-bench}
+mkdir -p $WORK
+
+# zstd is left out when its header is not installed
+ZSTD="-DENABLE_ZSTD=1 -lzstd"
+echo '#include <zstd.h>' | gcc $CFLAGS -E - > /dev/null 2>&1 || ZSTD=""
+gcc -O2 -pthread $CFLAGS -DENABLE_UPLOAD=1 -DENABLE_GZIP=1 $ROOT/src/main.c $ROOT/src/cargs.c $LDFLAGS -lssl -lcrypto -lz $ZSTD -o $WORK/docbuilder-upload
+gcc -O2 $ROOT/bench/corpus.c $ROOT/src/cargs.c -o $WORK/corpus
+
+CORPUS=$WORK/corpus-$PAGES-$SIZE
+[[ -d $CORPUS ]] || $WORK/corpus --output=$CORPUS --pages=$PAGES --size=$SIZE
+echo "corpus: $PAGES pages, $(du -sh $CORPUS | cut -f1)"
+
+export DOCBUILDER_TOKEN=test
+
+# scenario name, mock options, docbuilder options
+run () {
+    local name=$1 mock=$2 extra=$3
+    rm -f $WORK/upload-$name.db
+    python3 $ROOT/bench/weblite_mock.py --db=$WORK/upload-$name.db --port=$PORT $mock 2> $WORK/mock.log &
+    local pid=$!
+    until grep -q listening $WORK/mock.log 2> /dev/null; do sleep 0.1; done
+    
+    local start=$(date +%s%N)
+    local status=0
+    $WORK/docbuilder-upload --input=$CORPUS --output=$WORK/upload.sql --base-url=https://example.com/docs/ --json --use-front-matter --use-transactions \
+        --upload=http://127.0.0.1:$PORT/v2/weblite/sql --database=docs --autocomplete $extra > $WORK/upload.log || status=$?
+    local ms=$(( ($(date +%s%N) - start) / 1000000 ))
+    kill $pid; wait $pid 2> /dev/null || true
+    
+    local rows=$(sqlite3 $WORK/upload-$name.db "SELECT count(*) FROM documentation" 2> /dev/null || echo 0)
+    local result=OK
+    if [[ $status != 0 ]]; then
+        result="FAILED ($(cat $WORK/upload.log))"
+    elif [[ $name != clean ]] && ! cmp -s <(sqlite3 $WORK/upload-clean.db "SELECT url, content, options FROM documentation ORDER BY url") \
+                                          <(sqlite3 $WORK/upload-$name.db "SELECT url, content, options FROM documentation ORDER BY url"); then
+        result="DIFFERENT ROWS"
+    elif [[ $name != clean ]] && ! cmp -s <(sqlite3 $WORK/upload-clean.db "SELECT key, url, term, score FROM documentation_autocomplete ORDER BY url, key") \
+                                          <(sqlite3 $WORK/upload-$name.db "SELECT key, url, term, score FROM documentation_autocomplete ORDER BY url, key"); then
+        result="DIFFERENT AUTOCOMPLETE ROWS"
+    fi
+    echo "$name: ${ms}ms, $rows rows, $result $(tail -1 $WORK/mock.log)"
+}
+
+run clean "" ""
+run latency "--latency=50" ""
+run latency-no-pipeline "--latency=50" "--upload-pipeline=1"
+run small-requests "--latency=5" "--upload-bytes=65536"
+run errors "--fail=0.2 --seed=2" "--upload-bytes=262144"
+run drops "--drop=0.15 --seed=3" "--upload-bytes=262144"
+run closes "--close=0.3 --seed=4" "--upload-bytes=262144"
+run mixed "--latency=10 --fail=0.1 --drop=0.1 --close=0.1 --seed=5" "--upload-bytes=131072 --batch-rows=20"
+run gzip "" "--compress=gzip"
+run gzip-errors "--fail=0.1 --drop=0.1 --close=0.1 --seed=6" "--upload-bytes=131072 --compress=gzip:9"
+if [[ -n $ZSTD ]]; then run zstd "--drop=0.1 --seed=7" "--upload-bytes=131072 --compress=zstd:3"; fi
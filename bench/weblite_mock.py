@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+#
+# Local stand-in for the SQLite Cloud /v2/weblite/sql endpoint used to test --upload: it executes the
+# posted statements on a local sqlite database and can add latency, answer with errors, close the
+# connection after a response or drop it without answering (before or after running the statements).
+# Bodies sent with Content-Encoding gzip or zstd (--compress) are decoded before being parsed.
+# usage: bench/weblite_mock.py --db=out.db [--port=8181] [--latency=ms] [--fail=0.1] [--drop=0.05] [--close=0.05]
+#
+
+import argparse, gzip, json, random, signal, sqlite3, subprocess, sys, threading, time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--db', required=True)
+parser.add_argument('--port', type=int, default=8181)
+parser.add_argument('--token', default='test')
+parser.add_argument('--latency', type=float, default=0, help='ms added to each response')
+parser.add_argument('--fail', type=float, default=0, help='probability of a 503 response')
+parser.add_argument('--drop', type=float, default=0, help='probability of dropping the connection without a response')
+parser.add_argument('--close', type=float, default=0, help='probability of closing the connection after a response')
+parser.add_argument('--seed', type=int, default=1)
+args = parser.parse_args()
+
+random.seed(args.seed)
+lock = threading.Lock()
+stats = {'requests': 0, 'executed': 0, 'failed': 0, 'dropped': 0, 'closed': 0, 'connections': 0, 'bytes': 0, 'encoded': 0, 'decoded_bytes': 0}
+
+db = sqlite3.connect(args.db, check_same_thread=False, isolation_level=None)
+check = sqlite3.connect(':memory:', check_same_thread=False)
+# like the server json() of an invalid front matter would fail the request, here it is stored as NULL
+db.create_function('json', 1, lambda x: check.execute('select iif(json_valid(?1), json(?1), NULL)', (x,)).fetchone()[0])
+
+
+def zstd_decompress(data):
+    try:
+        import zstandard
+        return zstandard.ZstdDecompressor().decompressobj().decompress(data)
+    except ImportError:
+        pass
+    try:
+        from compression import zstd
+        return zstd.decompress(data)
+    except ImportError:
+        return subprocess.run(['zstd', '-dcq'], input=data, stdout=subprocess.PIPE, check=True).stdout
+
+
+def decode(body, encoding):
+    if encoding == 'gzip':
+        return gzip.decompress(body)
+    if encoding == 'zstd':
+        return zstd_decompress(body)
+    return body
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        super().setup()
+        with lock:
+            stats['connections'] += 1
+
+    def log_message(self, *_):
+        pass
+
+    def reply(self, status, payload, close=False):
+        body = json.dumps(payload).encode()
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        if close:
+            self.send_header('Connection', 'close')
+            self.close_connection = True
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get('Content-Length', 0)))
+        with lock:
+            stats['requests'] += 1
+            stats['bytes'] += len(body)
+            roll = random.random()
+        if args.latency:
+            time.sleep(args.latency / 1000)
+
+        if self.path != '/v2/weblite/sql' or self.headers.get('Authorization') != 'Bearer ' + args.token:
+            return self.reply(401, {'error': 'unauthorized'})
+        encoding = self.headers.get('Content-Encoding', 'identity')
+        if encoding not in ('identity', 'gzip', 'zstd'):
+            return self.reply(415, {'error': 'unsupported content encoding'})
+        try:
+            body = decode(body, encoding)
+        except Exception as e:
+            return self.reply(400, {'error': 'invalid %s body: %s' % (encoding, e)})
+        with lock:
+            stats['encoded'] += (encoding != 'identity')
+            stats['decoded_bytes'] += len(body)
+        if roll < args.fail:
+            with lock:
+                stats['failed'] += 1
+            return self.reply(503, {'error': 'service unavailable'})
+        if roll < args.fail + args.drop / 2:
+            # lost before being executed
+            with lock:
+                stats['dropped'] += 1
+            self.close_connection = True
+            return
+
+        request = json.loads(body)
+        with lock:
+            try:
+                db.executescript(request['sql'])
+                stats['executed'] += 1
+            except sqlite3.Error as e:
+                if db.in_transaction:
+                    db.execute('ROLLBACK')
+                return self.reply(200, {'error': str(e)})
+
+        if roll < args.fail + args.drop:
+            # executed but the response never arrives
+            with lock:
+                stats['dropped'] += 1
+            self.close_connection = True
+            return
+        close = roll < args.fail + args.drop + args.close
+        if close:
+            with lock:
+                stats['closed'] += 1
+        self.reply(200, {'data': 'OK'}, close)
+
+
+def stop(*_):
+    print(json.dumps(stats), file=sys.stderr, flush=True)
+    sys.exit(0)
+
+
+signal.signal(signal.SIGTERM, stop)
+server = ThreadingHTTPServer(('127.0.0.1', args.port), Handler)
+server.daemon_threads = True
+print('listening on %d' % args.port, file=sys.stderr, flush=True)
+server.serve_forever()
@@ -6,144 +6,599 @@
 //
 
 
-#define GENERATE_SQLITE_DATABASE    0
+#ifndef ENABLE_SQLITE_OUTPUT
+#define ENABLE_SQLITE_OUTPUT        0       // build with -DENABLE_SQLITE_OUTPUT=1 -lsqlite3 to support --format=sqlite
+#endif
+#ifndef ENABLE_UPLOAD
+#define ENABLE_UPLOAD               0       // build with -DENABLE_UPLOAD=1 -lssl -lcrypto to support --upload
+#endif
+#ifndef ENABLE_GZIP
+#define ENABLE_GZIP                 0       // build with -DENABLE_GZIP=1 -lz to support --compress=gzip
+#endif
+#ifndef ENABLE_ZSTD
+#define ENABLE_ZSTD                 0       // build with -DENABLE_ZSTD=1 -lzstd to support --compress=zstd
+#endif
+#ifndef ENABLE_IO_URING
+#ifdef __linux__
+#define ENABLE_IO_URING             1       // --read-ahead uses the io_uring syscalls directly, no liburing needed
+#else
+#define ENABLE_IO_URING             0
+#endif
+#endif
 #define DOCBUILDER_VERSION          "0.4"
+#define MANIFEST_VERSION            1
+#define MMAP_MIN_SIZE               (16*1024)
+#define DEFAULT_STREAM_THRESHOLD    (32*1024*1024)
+#define DEFAULT_BATCH_BYTES         (1024*1024)
+#define DEFAULT_UPLOAD_BYTES        (4*1024*1024)
+#define DEFAULT_UPLOAD_DEPTH        4
+#define UPLOAD_TOKEN_ENV            "DOCBUILDER_TOKEN"
+#define UPLOAD_TIMEOUT              300     // seconds
+#define UPLOAD_BACKOFF              250     // ms
+#define UPLOAD_MAX_ATTEMPTS         6
+#define UPLOAD_MAX_RESPONSE         4096
+#define HASH_INIT                   0xcbf29ce484222325ULL
+#define STATS_TOP                   10      // largest and slowest files listed by --stats
+#define MAX_READ_AHEAD              4096
+#define WORKER_WINDOW               4       // pages parsed but not yet written, for each worker thread
+#define OUTPUT_BLOCK_SIZE           (1024*1024)
+
+#ifndef MD_CHUNK_SIZE
+#define MD_CHUNK_SIZE               (256*1024)
+#endif
+#ifndef MD_MAX_LINE
+#define MD_MAX_LINE                 (64*1024)
+#endif
+#define AUTOCOMPLETE_WORDS          4       // keys of a title or heading, one for each of its first words
+#define AUTOCOMPLETE_KEY_MAX        64
+#define FRONT_MATTER_COLUMNS        8       // front matter keys copied to their own columns by --fts-front-matter
+#define FRONT_MATTER_KEY_MAX        32
+#define TABLE_COLUMNS_MAX           (4 + FRONT_MATTER_COLUMNS)
+#define FIELD_NULL                  ((size_t)-1)
+#define MD_LOOKAHEAD                4
+#define SQLITE_BATCH_ROWS           10000
+#define MD_SCAN_SINGLE              12
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MD_SIMD_X86                 1
+#else
+#define MD_SIMD_X86                 0
+#endif
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/stat.h>
-#if GENERATE_SQLITE_DATABASE
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if MD_SIMD_X86
+#include <immintrin.h>
+#endif
+#if ENABLE_SQLITE_OUTPUT
 #include <sqlite3.h>
 #endif
+#if ENABLE_UPLOAD
+#include <netdb.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#endif
+#if ENABLE_GZIP
+#include <zlib.h>
+#endif
+#if ENABLE_ZSTD
+#include <zstd.h>
+#endif
+#if ENABLE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 #include "cargs.h"
 
 #define DIRREF                      DIR*
 #define PATH_SEPARATOR              '/'
 
+// modification time of a struct stat, the nanoseconds are not in the same field on every platform
+#if defined(__APPLE__)
+#define STAT_MTIME_SEC(_sb)         ((_sb)->st_mtimespec.tv_sec)
+#define STAT_MTIME_NSEC(_sb)        ((_sb)->st_mtimespec.tv_nsec)
+#elif defined(__linux__)
+#define STAT_MTIME_SEC(_sb)         ((_sb)->st_mtim.tv_sec)
+#define STAT_MTIME_NSEC(_sb)        ((_sb)->st_mtim.tv_nsec)
+#else
+#define STAT_MTIME_SEC(_sb)         ((_sb)->st_mtime)
+#define STAT_MTIME_NSEC(_sb)        0
+#endif
+
 #define NEXT                        input[i++]
-#define PREV2                       input[i-3]
-#define PREV                        input[i-2]
+#define PREV2                       md_prev(parser, input, i, 3)
+#define PREV                        md_prev(parser, input, i, 2)
 #define CURRENT                     input[i-1]
 #define PEEK                        input[i]
 #define PEEK2                       input[i+1]
 #define NO_SKIP                     -1
 #define SET_SKIP_N(_c,_n)           do {toskip = _c; nskip = _n;} while(0)
 #define SET_SKIP(_c)                SET_SKIP_N(_c, 1)
-#define SKIP_UNTIL(_c)              do{i++;} while(PEEK == _c)
 #define RESET_SKIP()                do {toskip = NO_SKIP; nskip = 1;} while(0)
 
-#define OPTIONS_COL                  json_mode && use_front_matter
+#define OPTIONS_COL(_o)             (((_o)->json_mode || (_o)->format == FORMAT_SQLITE) && (_o)->use_front_matter)
+
+typedef enum {
+    FORMAT_SQL,                     // text file with the SQL statements
+    FORMAT_SQLITE,                  // ready to ship sqlite database with the FTS5 table
+    FORMAT_WEBLITE_JSON             // body of the weblite sql request: {"sql": "...", "database": "..."}
+} output_format;
+
+typedef enum {
+    FTS_CONTENT_INTERNAL,           // the FTS5 table stores the text of its rows (default)
+    FTS_CONTENT_EXTERNAL,           // rows stored in documentation_rows, the FTS5 table indexes them
+    FTS_CONTENT_NONE                // contentless index, only the other columns are stored in documentation_rows
+} fts_content;
+
+typedef enum {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+} compress_format;
+
+typedef struct {
+    const char  *src_path;
+    const char  *dest_path;
+    const char  *base_url;
+    bool        strip_html;
+    bool        strip_jsx;
+    bool        strip_md_title;
+    bool        use_front_matter;
+    bool        use_transaction;
+    bool        json_mode;
+    bool        path_using_slug;
+    bool        use_database;
+    bool        create_db;
+    int         nthreads;
+    bool        use_mmap;
+    size_t      stream_threshold;
+    const char  *incremental_path;
+    output_format format;
+    size_t      batch_rows;         // rows of each INSERT statement of the sql format
+    size_t      batch_bytes;        // a statement is closed before it grows over batch_bytes
+    const char  *upload_url;        // weblite sql endpoint, NULL when nothing is uploaded
+    const char  *database;
+    size_t      upload_bytes;
+    int         upload_depth;
+    bool        sql_escape;         // double the single quotes of the text (SQL string literals)
+    bool        json_escape;        // escape quotes and backslashes (the SQL is sent inside a JSON string)
+    bool        json_strict;        // escape newlines and control characters too, the output is valid JSON
+    bool        split_sections;     // one row for each #, ## and ### section of a page
+    const char  *fts_unindexed;     // comma separated columns stored but not indexed
+    const char  *fm_columns[FRONT_MATTER_COLUMNS];  // front matter keys with a column of their own
+    int         nfm_columns;
+    const char  *fts_weights;       // comma separated column:weight of the bm25 rank
+    const char  *columns;           // comma separated columns of the documentation table (table_columns)
+    const char  *fts_prefix;        // comma separated lengths of the prefix indexes
+    const char  *fts_detail;        // full, column or none
+    bool        fts_columnsize;
+    const char  *fts_tokenizer;
+    fts_content fts_content;
+    int         fts_automerge;      // FTS5 settings written after the load, -1 keeps the default
+    int         fts_crisismerge;
+    int         fts_pgsz;
+    bool        fts_optimize;       // merge the index into a single segment at the end of the sql file
+    bool        dedup;              // identical pages are indexed once, the other urls go to documentation_urls
+    const char  *stats_path;        // json file with the time of each phase, NULL when the times are not taken
+    bool        sort_walk;          // folders are walked in name order instead of the order of the file system
+    int         read_ahead;         // files opened and read by io_uring ahead of the parsers, 0 when the parsers read them
+    bool        autocomplete;       // page titles and headings are written to documentation_autocomplete
+    compress_format compress;       // of the sql file and of the uploaded requests
+    int         compress_level;     // -1 is the default level of the format
+} docbuilder_options;
+
+// list of md/mdx files collected by the directory walk (in walk order)
+typedef struct {
+    char        **paths;
+    size_t      count;
+    size_t      capacity;
+} doc_list;
+
+// growable buffer reused across files, it only grows so once the largest page has been parsed no other allocation is needed
+typedef struct {
+    char        *data;
+    size_t      capacity;
+} scratch_buffer;
+
+// per-thread scratch space used to parse a file
+typedef struct {
+    scratch_buffer  source;
+    scratch_buffer  buffer;
+    scratch_buffer  header;
+    scratch_buffer  json;
+    scratch_buffer  url;
+    scratch_buffer  slug;
+    scratch_buffer  sections;
+    scratch_buffer  titles;
+    scratch_buffer  fields;
+} file_scratch;
+
+// streaming gzip or zstd compressor, see compressor_write
+typedef struct {
+    compress_format format;
+    #if ENABLE_GZIP
+    z_stream        zs;
+    #endif
+    #if ENABLE_ZSTD
+    ZSTD_CCtx       *zstd;
+    #endif
+} compressor;
+
+// a file opened and read ahead of its parser (--read-ahead)
+typedef struct {
+    bool            opened;         // sb is valid
+    struct stat     sb;
+    char            *data;          // the whole file and two terminators, NULL when the parser reads it
+    size_t          size;
+} file_prefetch;
 
-#if GENERATE_SQLITE_DATABASE
-sqlite3 *db = NULL;
+// a part of a page that starts at a heading, title and anchor are offsets in the titles of the parser
+typedef struct {
+    size_t          start;          // position in the text of the page
+    size_t          title;
+    size_t          title_len;
+    size_t          anchor;
+    size_t          anchor_len;
+    int             level;          // 1 to 3, the number of #
+} md_section;
+
+// state of the markdown parser, carried across the chunks of a page
+typedef struct {
+    int             toskip;
+    int             nskip;
+    bool            is_code;
+    bool            done;           // end of the page (or first NUL byte) reached
+    bool            is_draft;
+    bool            has_slug;
+    size_t          offset;         // position in the page of the next chunk
+    size_t          space_run;      // position of the next space of a run to remove
+    size_t          line_end;       // end of the last line classified for imports
+    size_t          import_at;      // position of its last astro import, SIZE_MAX if there is none
+    char            last[2];        // the two bytes before the next chunk, last[0] is the closest
+    scratch_buffer  *header;        // front matter
+    size_t          header_len;
+    scratch_buffer  *slug;
+    size_t          slug_len;
+    scratch_buffer  *sections;      // md_section array, NULL unless the page is split at its headings
+    size_t          nsections;
+    scratch_buffer  *titles;
+    size_t          titles_len;
+} md_parser;
+
+// bytes that process_md must look at, everything else in a run of ordinary text is copied as-is
+typedef struct {
+    char            single[MD_SCAN_SINGLE]; // always handled by the parser, 0 for the unused slots
+    char            dash;                   // '-' when "--" can start a front matter or a separator, 0 otherwise
+    char            import;                 // 'i' when "im" can start an import line, 0 otherwise
+    char            control;                // 0xff when every byte below 0x20 must be escaped, 0 otherwise
+} md_scan_set;
+
+typedef size_t (*md_scan_text_fn)(const md_scan_set *set, const char *input, size_t i, size_t limit);
+typedef size_t (*md_scan_skip_fn)(const char *input, size_t i, size_t limit, char c);
+
+// vectorized scanners selected at startup, NULL pointers mean the plain byte loop of process_md
+typedef struct {
+    const char      *name;
+    md_scan_text_fn text;
+    md_scan_skip_fn skip;
+} md_scanner;
+
+// one line of the content manifest, path is relative to src_path and url is empty for pages not indexed (drafts)
+typedef struct {
+    char        *path;
+    int64_t     size;
+    int64_t     mtime_sec;
+    long        mtime_nsec;
+    uint64_t    hash;
+    char        *url;
+    uint64_t    key;            // hash of the processed page with --dedup, 0 when it is not deduplicated
+    bool        seen;
+} manifest_record;
+
+// open addressing hash table of the records of a previous manifest, strings point inside data
+typedef struct {
+    manifest_record *records;
+    size_t          capacity;
+    size_t          count;
+    char            *data;
+} manifest;
+
+// a page indexed with its text, the next pages with the same key only add their url to documentation_urls.
+// record is the line of the previous manifest of a page not written yet in this run (incremental mode)
+typedef struct {
+    uint64_t                key;
+    char                    *url;
+    char                    *path;      // relative to src_path, the page is parsed again to compare the text
+    const manifest_record   *record;
+} dedup_record;
+
+typedef struct {
+    dedup_record    *records;
+    size_t          capacity;
+    size_t          count;
+} dedup_table;
+
+#if ENABLE_UPLOAD
+// the sql of a request body, the pages it inserts are deleted first when it is sent again so a request
+// executed just before its connection dropped doesn't leave duplicated rows
+typedef struct {
+    scratch_buffer  sql;
+    size_t          sql_len;
+    doc_list        urls;
+    int             attempts;
+} upload_batch;
+
+typedef struct {
+    bool            tls;
+    char            *host;
+    char            *port;
+    char            *path;
+    const char      *token;
+    bool            use_transaction;    // each request runs in its own transaction
+    bool            split_sections;     // the rows of a page have its url followed by #anchor
+    const char      *table;             // table of the rows (see fts_target)
+    bool            dedup;              // the urls of the pages can be in documentation_urls too
+    size_t          batch_bytes;        // a request is sent at the first page boundary after batch_bytes
+    int             depth;              // requests sent without waiting for their response
+    
+    int             fd;
+    SSL_CTX         *ctx;
+    SSL             *ssl;
+    char            rbuf[16384];
+    size_t          rpos;
+    size_t          rlen;
+    scratch_buffer  head;               // request line and headers
+    scratch_buffer  body;               // beginning of the body, before the sql of the batch
+    scratch_buffer  tail;               // end of the body, after the sql of the batch (same for every request)
+    size_t          tail_len;
+    scratch_buffer  escaped;            // database name and urls of the cleanup statements
+    scratch_buffer  response;
+    size_t          response_len;
+    compressor      *compress;          // NULL when the bodies are sent as they are
+    scratch_buffer  compressed;
+    
+    upload_batch    current;            // filled by write_line
+    upload_batch    *queue;             // sent and waiting for their response, in send order
+    int             queue_count;
+    int             failures;           // consecutive connection failures
+    bool            ready;              // the schema has been acknowledged, the pages can be pipelined
+    size_t          nrequests;
+    size_t          nretries;
+} uploader;
 #endif
-FILE *f = NULL;
-
-const char *src_path = NULL;
-const char *dest_path = NULL;
-const char *base_url = NULL;
-bool strip_html = false;
-bool strip_jsx = false;
-bool strip_md_title = false;
-bool use_front_matter = false;
-bool use_transaction = false;
-bool json_mode = false;
-bool path_using_slug = false;
-bool use_database = false;
-bool create_db = false;
-bool status_draft = false;
+
+// wall and cpu time of the thread in ns, the times of the parallel phases are summed over the threads
+typedef struct {
+    uint64_t    wall;
+    uint64_t    cpu;
+} stats_time;
+
+typedef struct {
+    stats_time  read;           // stat, open and read (or mmap) of the file
+    stats_time  parse;          // process_md (and the dedup key)
+    stats_time  json;           // process_front_matter
+    stats_time  write;          // statements written by the main thread, streamed pages are parsed here too
+} file_stats;
+
+typedef struct {
+    char        *path;
+    int64_t     bytes_in;
+    size_t      bytes_out;
+    uint64_t    wall;
+} stats_file;
+
+// collected with --stats, see stats_write
+typedef struct {
+    stats_time  start;
+    stats_time  walk;
+    stats_time  read;
+    stats_time  parse;
+    stats_time  json;
+    stats_time  write;
+    stats_time  upload;         // waiting for the socket and for the responses of the uploaded requests
+    stats_time  finish;         // last statements, commit and optimize of the database
+    size_t      indexed;
+    size_t      streamed;
+    size_t      deduplicated;
+    size_t      unchanged;
+    size_t      drafts;
+    size_t      unreadable;
+    size_t      not_markdown;
+    int         read_ahead;     // depth used, 0 when the files are read by the parsers
+    uint64_t    bytes_in;
+    uint64_t    bytes_out;      // text of the rows, without the sql around it
+    stats_file  largest[STATS_TOP];
+    stats_file  slowest[STATS_TOP];
+} docbuilder_stats;
+
+// the sql file is filled in one block while a thread writes the other one (see output_writer_flush)
+typedef struct {
+    const char      *path;
+    int             fd;
+    char            *blocks[2];
+    int             current;        // block filled by the main thread
+    size_t          len;            // bytes in the current block
+    char            *pending;       // block handed to the thread, NULL when it is idle
+    size_t          pending_len;
+    int             error;          // errno of the first failed write
+    bool            closing;
+    compressor      *compress;      // NULL when the file is not compressed
+    scratch_buffer  compressed;     // used by the thread
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} output_writer;
+
+typedef struct {
+    output_writer *writer;      // NULL unless the format is sql or weblite-json
+    #if ENABLE_SQLITE_OUTPUT
+    sqlite3     *db;
+    sqlite3_stmt *insert_vm;    // prepared once and rebound for each page
+    sqlite3_stmt *delete_vm;
+    sqlite3_stmt *autocomplete_vm;
+    size_t      batch_rows;     // rows written in the current transaction
+    #endif
+    #if ENABLE_UPLOAD
+    uploader    *upload;        // NULL unless the statements are also uploaded
+    #endif
+    FILE        *manifest_f;
+    char        *manifest_path;
+    manifest    *previous;      // NULL unless running in incremental mode
+    doc_list    urls;           // urls written in this run, a removed page must not delete them
+    size_t      batch_count;    // rows of the INSERT statement still open, 0 when there is none
+    size_t      batch_size;
+    scratch_buffer section_url; // url#anchor of the row of a section
+    scratch_buffer section_title;
+    scratch_buffer autocomplete;    // VALUES of the next INSERT into documentation_autocomplete
+    size_t      autocomplete_len;
+    size_t      autocomplete_rows;
+    bool        json_strict;    // the statements are a json string (weblite-json, upload), newlines are written as \n
+    scratch_buffer statement;
+    scratch_buffer escaped;     // escaped copy of a url or of the database name
+    file_scratch scratch;       // used by the writer to stream the large pages
+    dedup_table dedup;          // pages indexed with --dedup, by key
+    file_scratch dedup_scratch; // page parsed again to check that its text is really the same
+    docbuilder_stats stats;
+} docbuilder_output;
+
+// result of the parsing of a single md/mdx file, ready to be written to the output
+// the strings point inside the parser scratch buffers unless they have been copied in block
+typedef struct {
+    const char  *url;
+    const char  *buffer;
+    size_t      size;
+    const char  *astro_header;
+    size_t      header_size;
+    const md_section *sections; // headings of the page with --split-sections or --autocomplete
+    size_t      nsections;
+    const char  *titles;
+    size_t      titles_len;
+    size_t      page_title;     // front matter title in titles, page_title_len is 0 when there is none
+    size_t      page_title_len;
+    const char  *fields;        // values of the front matter columns, escaped like the options
+    size_t      field_start[FRONT_MATTER_COLUMNS];
+    size_t      field_len[FRONT_MATTER_COLUMNS];    // FIELD_NULL when the page doesn't have the key
+    bool        skip;           // draft or unreadable file, nothing to write
+    char        *block;         // owned copy of the strings and of the sections (see detach_entry)
+    
+    // manifest info
+    const char  *path;          // relative to src_path, NULL when the file can't be read
+    const char  *full_path;
+    bool        streamed;       // too large to be loaded, parsed by the writer while it is written
+    int64_t     fsize;
+    int64_t     mtime_sec;
+    long        mtime_nsec;
+    uint64_t    hash;
+    uint64_t    key;            // hash of the processed page with --dedup (see dedup_key)
+    bool        unchanged;      // same content as the previous manifest, nothing to write
+    file_stats  stats;          // times of the page with --stats
+} doc_entry;
 
 // MARK: - I/O Utils -
 
-static bool is_directory (const char *path) {
-    struct stat buf;
+static char *scratch_reserve (scratch_buffer *scratch, size_t size) {
+    if (size <= scratch->capacity) return scratch->data;
     
-    if (lstat(path, &buf) < 0) return false;
-    if (S_ISDIR(buf.st_mode)) return true;
+    // grow geometrically so a sequence of slightly bigger pages doesn't realloc every time
+    size_t capacity = (scratch->capacity) ? scratch->capacity : 4096;
+    while (capacity < size) capacity *= 2;
     
-    return false;
+    char *data = (char *)realloc(scratch->data, capacity);
+    if (!data) {
+        printf("Not enough memory to allocate %zu bytes.", capacity);
+        exit(-3);
+    }
+    scratch->data = data;
+    scratch->capacity = capacity;
+    return data;
 }
 
-static char *directory_read (DIRREF ref) {
-    if (ref == NULL) return NULL;
-    
-    while (1) {
-        struct dirent *d;
-        if ((d = readdir(ref)) == NULL) {
-            closedir(ref);
-            return NULL;
+static void scratch_free (scratch_buffer *scratch) {
+    free(scratch->data);
+    scratch->data = NULL;
+    scratch->capacity = 0;
+}
+
+static void file_scratch_free (file_scratch *scratch) {
+    scratch_free(&scratch->source);
+    scratch_free(&scratch->buffer);
+    scratch_free(&scratch->header);
+    scratch_free(&scratch->json);
+    scratch_free(&scratch->url);
+    scratch_free(&scratch->slug);
+    scratch_free(&scratch->sections);
+    scratch_free(&scratch->titles);
+    scratch_free(&scratch->fields);
+}
+
+static void doc_list_add (doc_list *list, char *path) {
+    if (list->count == list->capacity) {
+        size_t capacity = (list->capacity) ? list->capacity * 2 : 256;
+        char **paths = (char **)realloc(list->paths, capacity * sizeof(char *));
+        if (!paths) {
+            printf("Not enough memory to allocate %zu bytes.", capacity * sizeof(char *));
+            exit(-3);
         }
-        if (d->d_name[0] == '\0') continue;
-        if (d->d_name[0] == '.') continue;
-        //if (use_front_matter && d->d_name[0] == '_') continue; // skipping files starting with _ like astro does
-        return (char *)d->d_name;
+        list->paths = paths;
+        list->capacity = capacity;
     }
-    return NULL;
+    list->paths[list->count++] = path;
 }
 
-static char *file_buildpath (const char *filename, const char *dirpath) {
-    size_t len1 = (filename) ? strlen(filename) : 0;
-    size_t len2 = (dirpath) ? strlen(dirpath) : 0;
-    size_t len = len1 + len2 + 4;
-    
-    char *full_path = (char *)malloc(len);
-    if (!full_path) return NULL;
-    
-    // check if PATH_SEPARATOR exists in dirpath
-    if ((len2) && (dirpath[len2-1] != PATH_SEPARATOR))
-        snprintf(full_path, len, "%s/%s", dirpath, filename);
-    else
-        snprintf(full_path, len, "%s%s", dirpath, filename);
-    
-    return full_path;
+static void doc_list_free (doc_list *list) {
+    for (size_t i = 0; i < list->count; ++i) free(list->paths[i]);
+    free(list->paths);
+    memset(list, 0, sizeof(doc_list));
 }
 
-static char *file_buildurl (const char *base_url, const char *fullpath) {
-    char *url = (char *)malloc(512);
-    if (!url) return NULL;
-    
-    char *path = strdup(fullpath);
-    if (!path) return NULL;
-    
-    char *p = (char *)path + strlen(src_path);
+static int doc_list_compare (const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static const char *file_relpath (const char *src_path, const char *fullpath) {
+    const char *p = fullpath + strlen(src_path);
     if (p[0] == '/') ++p;
+    return p;
+}
+
+static char *file_buildurl (const char *base_url, const char *src_path, const char *fullpath, scratch_buffer *scratch) {
+    char *url = scratch_reserve(scratch, 512);
     
-    char *index = strstr(p, "index.md");
+    const char *p = file_relpath(src_path, fullpath);
+    size_t plen = strlen(p);
+    
+    const char *index = strstr(p, "index.md");
     if (!index) index = strstr(p, "index.mdx");
     
     if (index) {
         // index page is different because it should be completely removed from the url
-        size_t ilen = strlen(index);
-        size_t plen = strlen(p);
-        p[plen-ilen] = 0;
+        plen = index - p;
     } else {
         // any other page
-        char *p2 = p;
-        while (p2[0]) {
-            if (p2[0] == '.') {
-                p2[0] = 0;
-                break;
-            }
-            ++p2;
-        }
+        const char *dot = strchr(p, '.');
+        if (dot) plen = dot - p;
     }
     
-    snprintf(url, 512, "%s%s", base_url, p);
-    
-    free(path);
+    snprintf(url, 512, "%s%.*s", base_url, (int)plen, p);
     return url;
-    
-}
-
-static int64_t file_size (const char *path) {
-    struct stat sb;
-    if (stat(path, &sb) < 0) return -1;
-    return (int64_t)sb.st_size;
 }
 
 static bool file_delete (const char *path) {
@@ -156,520 +611,4368 @@ static bool file_delete (const char *path) {
     return false;
 }
 
-static char *file_read(const char *path, size_t *len) {
-    int     fd = 0;
-    off_t   fsize = 0;
-    size_t  fsize2 = 0;
-    char    *buffer = NULL;
-    
-    fsize = (off_t) file_size(path);
-    if (fsize < 0) goto abort_read;
-    
-    int oflags = O_RDONLY;
-    fd = open(path, oflags);
-    if (fd < 0) goto abort_read;
+// 64-bit FNV-1a, hash_update can be called on consecutive chunks starting from HASH_INIT
+static uint64_t hash_update (uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t hash_bytes (const void *data, size_t len) {
+    return hash_update(HASH_INIT, data, len);
+}
+
+// 8 bytes per multiply instead of one, used on the whole processed text of every page by --dedup
+static uint64_t hash_content (uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    hash ^= len * 0x9e3779b97f4a7c15ULL;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w *= 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ (w ^ (w >> 31))) * 0x94d049bb133111ebULL;
+        hash = (hash << 27) | (hash >> 37);
+    }
+    uint64_t w = 0;
+    memcpy(&w, p, len);
+    hash = (hash ^ (w * 0xbf58476d1ce4e5b9ULL)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 29);
+}
+
+// reads the whole file in the scratch buffer (or in a new malloc-ed buffer when scratch is NULL)
+static char *file_read_fd (int fd, struct stat *sb, scratch_buffer *scratch, size_t *len) {
+    size_t fsize = (size_t)sb->st_size;
+    char *buffer = (scratch) ? scratch_reserve(scratch, fsize + 2) : (char *)malloc(fsize + 2);
+    if (buffer == NULL) return NULL;
     
-    buffer = (char *)malloc((size_t)fsize + 1);
-    if (buffer == NULL) goto abort_read;
+    // two terminators because the parser peeks one byte past the end
     buffer[fsize] = 0;
+    buffer[fsize + 1] = 0;
+    
+    size_t fsize2 = 0;
+    while (fsize2 < fsize) {
+        ssize_t nread = read(fd, buffer + fsize2, fsize - fsize2);
+        if (nread <= 0) break;
+        fsize2 += (size_t)nread;
+    }
     
-    fsize2 = read(fd, buffer, (size_t)fsize);
-    if (fsize2 != fsize) goto abort_read;
+    if (fsize2 != fsize) {
+        if (!scratch) free(buffer);
+        return NULL;
+    }
     
     if (len) *len = fsize2;
-    close(fd);
-    return (char *)buffer;
+    return buffer;
+}
+
+// hashes the whole file reading it in chunks of at most MD_CHUNK_SIZE bytes
+static bool file_hash_fd (int fd, scratch_buffer *scratch, uint64_t *hash) {
+    char *buffer = scratch_reserve(scratch, MD_CHUNK_SIZE);
+    uint64_t h = HASH_INIT;
     
-abort_read:
-    if (buffer) free((void *)buffer);
-    if (fd >= 0) close(fd);
-    return NULL;
+    while (1) {
+        ssize_t nread = read(fd, buffer, MD_CHUNK_SIZE);
+        if (nread < 0) return false;
+        if (nread == 0) break;
+        h = hash_update(h, buffer, (size_t)nread);
+    }
+    
+    *hash = h;
+    return true;
 }
 
-// MARK: -
+static char *file_read_into (const char *path, scratch_buffer *scratch, size_t *len, struct stat *sb) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    
+    char *buffer = (fstat(fd, sb) == 0) ? file_read_fd(fd, sb, scratch, len) : NULL;
+    close(fd);
+    return buffer;
+}
+
+static char *file_read (const char *path, size_t *len, struct stat *sb) {
+    return file_read_into(path, NULL, len, sb);
+}
 
-static bool check_line (const char *current, const char *begin_with, const char *end_with) {
-    // find the end of the current line
-    if (strlen(begin_with) > strlen(current)) return false;
-    const char *line_end = strchr(current+strlen(begin_with), '\n');
-    if (!line_end) line_end = current + strlen(current); // No newline, use end of string
+// Maps the file read-only instead of copying it in the scratch buffer. The parser needs the source
+// to be NUL terminated (and peeks one byte past the terminator) so the file is mapped only when the
+// zero-filled tail of its last page has room for two bytes, otherwise and for files smaller than
+// MMAP_MIN_SIZE (where the mapping costs more than the copy) it falls back to a plain read.
+static char *file_map_fd (int fd, struct stat *sb, scratch_buffer *scratch, size_t *len, bool *mapped) {
+    *mapped = false;
+    
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t fsize = (size_t)sb->st_size;
+    size_t tail = fsize % page_size;
+    void *buffer = MAP_FAILED;
+    if (fsize >= MMAP_MIN_SIZE && tail != 0 && tail <= page_size - 2) {
+        buffer = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
     
-    // search for begin_with within the line
-    const char *found1 = strstr(current, begin_with);
-    if (!found1 || found1 > line_end) return false;
+    if (buffer == MAP_FAILED) return file_read_fd(fd, sb, scratch, len);
     
-    // search for end_with after found1 but within the line
-    const char *found2 = strstr(found1 + strlen(begin_with), end_with);
-    if (!found2 || found2 > line_end) return false;
+    madvise(buffer, fsize, MADV_SEQUENTIAL);
+    madvise(buffer, fsize, MADV_WILLNEED);
     
-    return true;
+    *mapped = true;
+    if (len) *len = fsize;
+    return (char *)buffer;
 }
 
-static char *match_copy(const char *str, const char match) {
-    const char *pos = strchr(str, match);
-    
-    if (pos != NULL) {
-        size_t length = pos - str;
-        
-        char *cp_str = (char *)malloc(length + 1);
-        if (cp_str == NULL) return NULL;
-        
-        strncpy(cp_str, str, length);
-        cp_str[length] = '\0';
-        
-        return cp_str;
+static void file_unmap (char *buffer, size_t len, bool mapped) {
+    if (mapped) munmap(buffer, len);
+}
+
+// MARK: - Manifest -
+
+// The manifest is a tab separated text file written next to the output, one line per md/mdx file:
+// path, size, mtime, content hash, url and, with --dedup, the key of the processed page. In incremental
+// mode the previous manifest is used to emit only the DELETE/INSERT statements for the pages added,
+// changed or removed since it was written.
+
+static uint64_t fingerprint_add (uint64_t hash, const char *s) {
+    return (s) ? hash_update(hash, s, strlen(s)) : hash;
+}
+
+static uint64_t manifest_fingerprint (const docbuilder_options *options) {
+    // every option that changes the generated rows, a different fingerprint forces a full rebuild. The pieces are
+    // hashed one after the other (FNV-1a is the same as on their concatenation), so no length is ever too long
+    char flags[64];
+    snprintf(flags, sizeof(flags), "|%d%d%d%d%d%d", options->strip_html, options->strip_jsx, options->strip_md_title,
+             options->use_front_matter, options->json_mode, options->path_using_slug);
+    uint64_t hash = fingerprint_add(HASH_INIT, options->base_url);
+    hash = fingerprint_add(hash, flags);
+    if (options->format == FORMAT_SQLITE) hash = fingerprint_add(hash, "|sqlite");
+    if (options->split_sections) hash = fingerprint_add(hash, "|sections");
+    if (options->dedup) hash = fingerprint_add(hash, "|dedup");
+    if (options->autocomplete) hash = fingerprint_add(hash, "|autocomplete");
+    for (int k = 0; k < options->nfm_columns; ++k) {
+        hash = fingerprint_add(hash, "|column:");
+        hash = fingerprint_add(hash, options->fm_columns[k]);
     }
     
+    // a different layout of the index needs a new table
+    if (options->fts_unindexed || options->fts_prefix || options->fts_detail || !options->fts_columnsize || options->fts_tokenizer || options->fts_content != FTS_CONTENT_INTERNAL) {
+        hash = fingerprint_add(hash, "|fts|");
+        hash = fingerprint_add(hash, options->fts_unindexed);
+        hash = fingerprint_add(hash, "|");
+        hash = fingerprint_add(hash, options->fts_prefix);
+        hash = fingerprint_add(hash, "|");
+        hash = fingerprint_add(hash, options->fts_detail);
+        snprintf(flags, sizeof(flags), "|%d|%d|", options->fts_columnsize, options->fts_content);
+        hash = fingerprint_add(hash, flags);
+        hash = fingerprint_add(hash, options->fts_tokenizer);
+    }
+    return hash;
+}
+
+static manifest_record *manifest_lookup (const manifest *m, const char *path) {
+    size_t index = (size_t)hash_bytes(path, strlen(path)) & (m->capacity - 1);
+    while (m->records[index].path) {
+        if (strcmp(m->records[index].path, path) == 0) return &m->records[index];
+        index = (index + 1) & (m->capacity - 1);
+    }
     return NULL;
 }
 
-static char *process_md (const char *input, char *buffer, size_t *len, char *astro_header, size_t *header_len) {
+// same size and mtime of the previous run
+static bool manifest_same_stat (const manifest_record *record, const struct stat *sb) {
+    return sb->st_size == record->size && STAT_MTIME_SEC(sb) == record->mtime_sec && STAT_MTIME_NSEC(sb) == record->mtime_nsec;
+}
+
+static void manifest_free (manifest *m) {
+    if (!m) return;
+    free(m->records);
+    free(m->data);
+    free(m);
+}
 
-    bool is_code = false;
-    int toskip = NO_SKIP;
-    int nskip = 1;
-    int i = 0, j = 0, h = 0, slug_index = 6; // 6 is the length of the string "slug: "
+static manifest *manifest_load (const char *path, uint64_t fingerprint) {
+    size_t size = 0;
+    struct stat sb;
+    char *data = file_read(path, &size, &sb);
+    if (!data) {
+        printf("Unable to read manifest %s, doing a full rebuild.\n", path);
+        return NULL;
+    }
     
-    while (input[i]) {
-        int c = NEXT;
+    unsigned long long header_fingerprint = 0;
+    int version = 0;
+    if ((sscanf(data, "# docbuilder-manifest %d %llx", &version, &header_fingerprint) != 2) || (version != MANIFEST_VERSION) || (header_fingerprint != fingerprint)) {
+        printf("Manifest %s has been created with different options, doing a full rebuild.\n", path);
+        free(data);
+        return NULL;
+    }
+    
+    size_t nlines = 0;
+    for (size_t i = 0; i < size; ++i) if (data[i] == '\n') ++nlines;
+    
+    manifest *m = (manifest *)calloc(1, sizeof(manifest));
+    size_t capacity = 16;
+    while (capacity < nlines * 2) capacity <<= 1;
+    manifest_record *records = (manifest_record *)calloc(capacity, sizeof(manifest_record));
+    if (!m || !records) {
+        printf("Not enough memory to allocate %zu bytes.", capacity * sizeof(manifest_record));
+        exit(-3);
+    }
+    m->records = records;
+    m->capacity = capacity;
+    m->data = data;
+    
+    // skip the header line
+    char *line = strchr(data, '\n');
+    while (line && *++line) {
+        char *end = strchr(line, '\n');
+        if (end) *end = 0;
         
-        if (toskip != NO_SKIP) {
-            if (c == toskip) {
-                if (nskip == 1) {
-                    RESET_SKIP();
-                } else if (nskip == 3) {
-                    if((PEEK == toskip) && (PEEK2 == toskip)){
-                        NEXT; // -
-                        NEXT; // -
-                        NEXT; // \n
-                        RESET_SKIP();
-                    } else if( ((PREV != toskip) && (PEEK != toskip)) || ((PREV != toskip) && (PREV2 != toskip)) ) astro_header[h++] = c;
-                }
-            } else if(toskip == '-' && nskip == 3) {
-                if(path_using_slug && c == '\n' && PEEK == 's' && PEEK2 == 'l' && check_line(&input[i-1], "\nslug: ", "\n")) slug_index += i;
-                if(use_front_matter && c == '\n' && PEEK == 's' && PEEK2 == 't' && check_line(&input[i-1], "\nstatus:", "draft")){
-                    status_draft = true;
-                    return NULL;
-                }
-                astro_header[h++] = c;
-            }
-            continue;
+        // the key of the page is written only with --dedup
+        char *fields[6];
+        int nfields = 0;
+        char *p = line;
+        while (nfields < 6) {
+            fields[nfields++] = p;
+            p = strchr(p, '\t');
+            if (!p) break;
+            *p++ = 0;
         }
-                
-        switch (c) {
-            case '#': {
-                if (strip_md_title == false) break;
-                SET_SKIP('\n');
-                continue;
-            }
-                
-            case '!': {
-                SET_SKIP('\n');
-                continue;
-            }
-                
-            case '<': {
-                if (strip_html == false) break;
-                SET_SKIP('>');
-                continue;
-            }
-                
-            case '{': {
-                if (strip_jsx == false) break;
-                SET_SKIP('}');
-                continue;
-            }
-                
-            case '[':
-            case ']':
-            case '*': {
-                // skip character
-                continue;
-            }
+        
+        if (nfields >= 5 && fields[0][0]) {
+            manifest_record record = {0};
+            record.path = fields[0];
+            record.size = strtoll(fields[1], NULL, 10);
+            char *nsec = NULL;
+            record.mtime_sec = strtoll(fields[2], &nsec, 10);
+            record.mtime_nsec = (nsec && *nsec == '.') ? strtol(nsec + 1, NULL, 10) : 0;
+            record.hash = strtoull(fields[3], NULL, 16);
+            record.url = fields[4];
+            record.key = (nfields == 6) ? strtoull(fields[5], NULL, 16) : 0;
             
-            case '\n': {
-                // remove double \n
-                if (PEEK == '\n') continue;
-                break;
-            }
-                
-            case '"':
-            case '\\': {
-                if (json_mode) buffer[j++] = '\\';
-                break;
-            }
-
-            case '\t': {
-                // replace tabulations with spaces
-                if (json_mode){
-                    if(PEEK == '\t'){
-                        continue;
-                    } else {
-                        c = ' ';
-                    }
-                }
-                break;
-            }
-
-            case ' ': {
-                // remove multiple spaces
-                if (PEEK == ' ') SKIP_UNTIL(' ');
-                break;
-            }
-                
-            case 'i': {
-                if (strip_jsx == false) break;
-                // remove import jsx statement
-                if ((PEEK == 'm') && (PEEK2 == 'p') && check_line(&input[i-1], "import ", ".astro\"")) {
-                    SET_SKIP('\n');
-                    continue;
-                }
-                break;
-            }
-                
-            case '`': {
-                // check peek and peek2
-                if ((PEEK == '`') && (PEEK2 == '`')) {
-                    is_code = !is_code;
-                    SET_SKIP('\n');
-                    continue;
-                }
-                break;
-            }
-                
-#if !GENERATE_SQLITE_DATABASE
-            case '\'': {
-                // escape single character
-                buffer[j++] = '\'';
-                buffer[j++] = '\'';
-                continue;
-            }
-#endif
-                
-            case '(': {
-                if ((PEEK == 'h') || (PEEK == '\\')) {
-                    SET_SKIP(')');
-                    continue;
-                }
-                break;
-            }
-                
-            case '-': {
-                if ((PEEK == '-') && (PEEK2 == '-') && use_front_matter) {
-                    if (i == 1) {
-                        // process meta
-                        SET_SKIP_N('-', 3);
-                    } else {
-                        SET_SKIP('\n');
-                    }
-                    continue;
-                }
+            if (!manifest_lookup(m, record.path)) {
+                size_t index = (size_t)hash_bytes(record.path, strlen(record.path)) & (m->capacity - 1);
+                while (m->records[index].path) index = (index + 1) & (m->capacity - 1);
+                m->records[index] = record;
+                ++m->count;
             }
         }
         
-        // copy character as-is
-        buffer[j++] = c;
+        line = end;
     }
     
-    *len = j;
-    buffer[j] = 0;
-    *header_len = h;
-    astro_header[h] = 0;
-    if(slug_index == 6) return NULL; // no slug found
-    return match_copy(&input[slug_index], '\n');
+    return m;
 }
 
-static void process_json (char *input, size_t *header_len) {
-
-    *header_len = *header_len * 2;
-    char *astro_header = (char *)malloc(*header_len);
-    if (!astro_header) {
-        printf("Not enough memory to allocate %zu bytes.", *header_len);
+static void manifest_create (const docbuilder_options *options, docbuilder_output *output, const char *path) {
+    size_t len = strlen(path) + 16;
+    output->manifest_path = (char *)malloc(len);
+    char *tmp_path = (char *)malloc(len);
+    if (!output->manifest_path || !tmp_path) {
+        printf("Not enough memory to allocate %zu bytes.", len);
         exit(-3);
     }
+    snprintf(output->manifest_path, len, "%s.manifest", path);
+    snprintf(tmp_path, len, "%s.manifest.tmp", path);
+    
+    // the manifest is written to a temporary file so a failed run never replaces the previous one
+    output->manifest_f = fopen(tmp_path, "w");
+    if (!output->manifest_f) {
+        printf("Unable to create manifest file :%s.", tmp_path);
+        exit(-2);
+    }
+    free(tmp_path);
+    
+    fprintf(output->manifest_f, "# docbuilder-manifest %d %016llx\n", MANIFEST_VERSION, (unsigned long long)manifest_fingerprint(options));
+}
+
+static void manifest_add (const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry) {
+    if (!entry->path) return;
+    
+    int nwrote = fprintf(output->manifest_f, "%s\t%lld\t%lld.%09ld\t%016llx\t%s", entry->path, (long long)entry->fsize,
+                         (long long)entry->mtime_sec, entry->mtime_nsec, (unsigned long long)entry->hash, (entry->url) ? entry->url : "");
+    if (nwrote >= 0) nwrote = (options->dedup) ? fprintf(output->manifest_f, "\t%016llx\n", (unsigned long long)entry->key) : fputc('\n', output->manifest_f);
+    if (nwrote < 0) {
+        printf("Write fails: %s.", output->manifest_path);
+        exit(-6);
+    }
+}
+
+static void manifest_close (docbuilder_output *output) {
+    if (!output->manifest_f) return;
+    
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", output->manifest_path);
+    
+    if (fclose(output->manifest_f) != 0 || rename(tmp_path, output->manifest_path) != 0) {
+        printf("Unable to write manifest file :%s.", output->manifest_path);
+        exit(-6);
+    }
+    output->manifest_f = NULL;
+    free(output->manifest_path);
+    output->manifest_path = NULL;
+}
+
+// MARK: - Deduplication Table -
+
+static dedup_record *dedup_lookup (const dedup_table *table, uint64_t key) {
+    if (table->capacity == 0) return NULL;
+    size_t index = (size_t)key & (table->capacity - 1);
+    while (table->records[index].key) {
+        if (table->records[index].key == key) return &table->records[index];
+        index = (index + 1) & (table->capacity - 1);
+    }
+    return NULL;
+}
+
+// adds the page with the key or replaces the page already there
+static void dedup_insert (dedup_table *table, uint64_t key, const char *url, const char *path, const manifest_record *record) {
+    dedup_record *r = dedup_lookup(table, key);
+    if (!r && (table->count + 1) * 2 > table->capacity) {
+        size_t capacity = (table->capacity) ? table->capacity * 2 : 1024;
+        dedup_record *records = (dedup_record *)calloc(capacity, sizeof(dedup_record));
+        if (!records) {
+            printf("Not enough memory to allocate %zu bytes.", capacity * sizeof(dedup_record));
+            exit(-3);
+        }
+        for (size_t i = 0; i < table->capacity; ++i) {
+            if (!table->records[i].key) continue;
+            size_t index = (size_t)table->records[i].key & (capacity - 1);
+            while (records[index].key) index = (index + 1) & (capacity - 1);
+            records[index] = table->records[i];
+        }
+        free(table->records);
+        table->records = records;
+        table->capacity = capacity;
+    }
+    if (!r) {
+        size_t index = (size_t)key & (table->capacity - 1);
+        while (table->records[index].key) index = (index + 1) & (table->capacity - 1);
+        r = &table->records[index];
+        ++table->count;
+    } else {
+        free(r->url);
+        free(r->path);
+    }
+    
+    r->key = key;
+    r->url = strdup(url);
+    r->path = strdup(path);
+    r->record = record;
+    if (!r->url || !r->path) exit(-11);
+}
+
+// in incremental mode the pages indexed by the previous run can be used before they are reached by the walk
+static void dedup_seed (dedup_table *table, const manifest *previous) {
+    for (size_t i = 0; i < previous->capacity; ++i) {
+        const manifest_record *record = &previous->records[i];
+        if (!record->path || !record->key || !record->url[0] || dedup_lookup(table, record->key)) continue;
+        dedup_insert(table, record->key, record->url, record->path, record);
+    }
+}
+
+static void dedup_free (dedup_table *table) {
+    for (size_t i = 0; i < table->capacity; ++i) {
+        free(table->records[i].url);
+        free(table->records[i].path);
+    }
+    free(table->records);
+    memset(table, 0, sizeof(dedup_table));
+}
+
+// MARK: - Text Scanner -
+
+// Most of a page is ordinary text that process_md copies byte by byte. The scanners look at 16 or 32
+// bytes at once and return the position of the first byte (from i) that needs the parser: a byte of
+// the scan set, a NUL, or the first byte of a pair like "  ", "\n\n", "``", "(h" or "--". Spaces and
+// newlines are common in prose so they stop the scan only when they are part of a pair.
+// A scan starts at i >= 1 (it looks at the byte before) and never reads past limit.
+
+static md_scanner scanner = {"scalar", NULL, NULL};
+
+static void md_scan_set_init (const docbuilder_options *options, md_scan_set *set) {
+    const char single[MD_SCAN_SINGLE] = {
+        '!', '[', ']', '*',
+        (options->sql_escape) ? '\'' : 0,
+        (options->strip_md_title || options->split_sections || options->autocomplete) ? '#' : 0,
+        (options->strip_html) ? '<' : 0,
+        (options->strip_jsx) ? '{' : 0,
+        (options->json_escape) ? '"' : 0,
+        (options->json_escape) ? '\\' : 0,
+        (options->json_mode) ? '\t' : 0,
+        0
+    };
+    memcpy(set->single, single, sizeof(single));
+    set->dash = (options->use_front_matter) ? '-' : 0;
+    set->import = (options->strip_jsx) ? 'i' : 0;
+    set->control = (options->json_strict) ? (char)0xff : 0;
+}
+
+#if MD_SIMD_X86
+static size_t md_scan_text_sse2 (const md_scan_set *set, const char *input, size_t i, size_t limit) {
+    __m128i single[MD_SCAN_SINGLE];
+    for (int k = 0; k < MD_SCAN_SINGLE; ++k) single[k] = _mm_set1_epi8(set->single[k]);
+    const __m128i space = _mm_set1_epi8(' '), newline = _mm_set1_epi8('\n'), backtick = _mm_set1_epi8('`');
+    const __m128i paren = _mm_set1_epi8('('), h = _mm_set1_epi8('h'), backslash = _mm_set1_epi8('\\');
+    const __m128i dash = _mm_set1_epi8(set->dash), minus = _mm_set1_epi8('-');
+    const __m128i import = _mm_set1_epi8(set->import), m = _mm_set1_epi8('m');
+    const __m128i control = _mm_set1_epi8(set->control), below = _mm_set1_epi8(0x1f);
+    
+    while (i + 16 < limit) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i next = _mm_loadu_si128((const __m128i *)(input + i + 1));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(input + i - 1));
+        
+        __m128i found = _mm_cmpeq_epi8(cur, single[0]);
+        for (int k = 1; k < MD_SCAN_SINGLE; ++k) found = _mm_or_si128(found, _mm_cmpeq_epi8(cur, single[k]));
+        
+        __m128i pairs = _mm_and_si128(_mm_cmpeq_epi8(cur, space), _mm_or_si128(_mm_cmpeq_epi8(next, space), _mm_cmpeq_epi8(prev, space)));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(_mm_cmpeq_epi8(cur, newline), _mm_cmpeq_epi8(next, newline)));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(_mm_cmpeq_epi8(cur, backtick), _mm_cmpeq_epi8(next, backtick)));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(_mm_cmpeq_epi8(cur, paren), _mm_or_si128(_mm_cmpeq_epi8(next, h), _mm_cmpeq_epi8(next, backslash))));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(_mm_cmpeq_epi8(cur, dash), _mm_cmpeq_epi8(next, minus)));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(_mm_cmpeq_epi8(cur, import), _mm_cmpeq_epi8(next, m)));
+        pairs = _mm_or_si128(pairs, _mm_and_si128(control, _mm_cmpeq_epi8(_mm_max_epu8(cur, below), below)));
+        
+        int mask = _mm_movemask_epi8(_mm_or_si128(found, pairs));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i;
+}
+
+static size_t md_scan_skip_sse2 (const char *input, size_t i, size_t limit, char c) {
+    const __m128i target = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+    
+    while (i + 16 <= limit) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(input + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(cur, target), _mm_cmpeq_epi8(cur, zero)));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t md_scan_text_avx2 (const md_scan_set *set, const char *input, size_t i, size_t limit) {
+    __m256i single[MD_SCAN_SINGLE];
+    for (int k = 0; k < MD_SCAN_SINGLE; ++k) single[k] = _mm256_set1_epi8(set->single[k]);
+    const __m256i space = _mm256_set1_epi8(' '), newline = _mm256_set1_epi8('\n'), backtick = _mm256_set1_epi8('`');
+    const __m256i paren = _mm256_set1_epi8('('), h = _mm256_set1_epi8('h'), backslash = _mm256_set1_epi8('\\');
+    const __m256i dash = _mm256_set1_epi8(set->dash), minus = _mm256_set1_epi8('-');
+    const __m256i import = _mm256_set1_epi8(set->import), m = _mm256_set1_epi8('m');
+    const __m256i control = _mm256_set1_epi8(set->control), below = _mm256_set1_epi8(0x1f);
+    
+    while (i + 32 < limit) {
+        __m256i cur = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i next = _mm256_loadu_si256((const __m256i *)(input + i + 1));
+        __m256i prev = _mm256_loadu_si256((const __m256i *)(input + i - 1));
+        
+        __m256i found = _mm256_cmpeq_epi8(cur, single[0]);
+        for (int k = 1; k < MD_SCAN_SINGLE; ++k) found = _mm256_or_si256(found, _mm256_cmpeq_epi8(cur, single[k]));
+        
+        __m256i pairs = _mm256_and_si256(_mm256_cmpeq_epi8(cur, space), _mm256_or_si256(_mm256_cmpeq_epi8(next, space), _mm256_cmpeq_epi8(prev, space)));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(_mm256_cmpeq_epi8(cur, newline), _mm256_cmpeq_epi8(next, newline)));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(_mm256_cmpeq_epi8(cur, backtick), _mm256_cmpeq_epi8(next, backtick)));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(_mm256_cmpeq_epi8(cur, paren), _mm256_or_si256(_mm256_cmpeq_epi8(next, h), _mm256_cmpeq_epi8(next, backslash))));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(_mm256_cmpeq_epi8(cur, dash), _mm256_cmpeq_epi8(next, minus)));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(_mm256_cmpeq_epi8(cur, import), _mm256_cmpeq_epi8(next, m)));
+        pairs = _mm256_or_si256(pairs, _mm256_and_si256(control, _mm256_cmpeq_epi8(_mm256_max_epu8(cur, below), below)));
+        
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(found, pairs));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t md_scan_skip_avx2 (const char *input, size_t i, size_t limit, char c) {
+    const __m256i target = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+    
+    while (i + 32 <= limit) {
+        __m256i cur = _mm256_loadu_si256((const __m256i *)(input + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(cur, target), _mm256_cmpeq_epi8(cur, zero)));
+        if (mask) return i + __builtin_ctz(mask);
+        i += 32;
+    }
+    return i;
+}
+#endif
+
+// name is auto (the best one supported by the cpu), avx2, sse2 or scalar
+static bool md_scanner_init (const char *name) {
+    bool is_auto = (name == NULL || strcmp(name, "auto") == 0);
+    
+    #if MD_SIMD_X86
+    __builtin_cpu_init();
+    if ((is_auto && __builtin_cpu_supports("avx2")) || (name && strcmp(name, "avx2") == 0)) {
+        if (!__builtin_cpu_supports("avx2")) return false;
+        scanner = (md_scanner){"avx2", md_scan_text_avx2, md_scan_skip_avx2};
+        return true;
+    }
+    if ((is_auto && __builtin_cpu_supports("sse2")) || (name && strcmp(name, "sse2") == 0)) {
+        if (!__builtin_cpu_supports("sse2")) return false;
+        scanner = (md_scanner){"sse2", md_scan_text_sse2, md_scan_skip_sse2};
+        return true;
+    }
+    #endif
+    
+    scanner = (md_scanner){"scalar", NULL, NULL};
+    return (is_auto || strcmp(name, "scalar") == 0);
+}
+
+// MARK: - Markdown Parser -
+
+// The parser is resumable: it consumes the input in chunks and carries its state (skip mode, front
+// matter, space runs and the two bytes before the chunk) across calls, so a page can be parsed from
+// memory in a single call or streamed from disk with a constant amount of memory.
+
+static void md_parser_init (md_parser *parser, scratch_buffer *header, scratch_buffer *slug) {
+    memset(parser, 0, sizeof(md_parser));
+    parser->toskip = NO_SKIP;
+    parser->nskip = 1;
+    parser->space_run = SIZE_MAX;
+    parser->header = header;
+    parser->slug = slug;
+}
+
+// true once the front matter (if any) has been completely parsed, url and draft status are final
+static bool md_parser_header_done (const md_parser *parser) {
+    return (parser->offset > 0) && !(parser->toskip == '-' && parser->nskip == 3);
+}
+
+static int md_prev (const md_parser *parser, const char *input, size_t i, size_t n) {
+    // n bytes back from the next one, it can fall before the current chunk
+    return (i >= n) ? input[i-n] : parser->last[n-i-1];
+}
+
+static void md_header_add (md_parser *parser, char c) {
+    if (parser->header_len + 1 >= parser->header->capacity) scratch_reserve(parser->header, parser->header_len + 2);
+    parser->header->data[parser->header_len++] = c;
+}
+
+static const char *md_find (const char *s, const char *end, const char *needle, size_t needle_len) {
+    while (s + needle_len <= end) {
+        const char *p = memchr(s, needle[0], (end - s) - needle_len + 1);
+        if (!p) return NULL;
+        if (memcmp(p, needle, needle_len) == 0) return p;
+        s = p + 1;
+    }
+    return NULL;
+}
+
+// end of the line starting at from: the next newline, the end of the input when the line is longer
+// than MD_MAX_LINE or at the end of the file, NULL when more input is needed to find it
+static const char *md_line_end (const char *input, size_t from, size_t len, bool eof, bool *found) {
+    const char *line = input + from;
+    const char *end = memchr(line, '\n', len - from);
+    *found = (end != NULL);
+    if (end) return end;
+    if (eof || len - from >= MD_MAX_LINE) return input + len;
+    return NULL;
+}
+
+// value of the title: line of the front matter without its quotes, NULL when there is none
+static const char *md_header_title (const md_parser *parser, size_t *len) {
+    const char *header = parser->header->data, *end = header + parser->header_len;
+    for (const char *line = header; line && line < end; line = memchr(line, '\n', end - line)) {
+        if (*line == '\n') ++line;
+        if (line + 6 > end || memcmp(line, "title:", 6) != 0) continue;
+        const char *value = line + 6, *value_end = memchr(value, '\n', end - value);
+        if (!value_end) value_end = end;
+        while (value < value_end && (unsigned char)*value <= ' ') ++value;
+        while (value_end > value && (unsigned char)value_end[-1] <= ' ') --value_end;
+        if (value_end - value >= 2 && (*value == '"' || *value == '\'') && value_end[-1] == *value) {++value; --value_end;}
+        *len = value_end - value;
+        return (*len) ? value : NULL;
+    }
+    return NULL;
+}
+
+// last "import " of the line followed by .astro" (both within the line), NULL if the line doesn't import a component
+static const char *md_find_import (const char *line, const char *end) {
+    const char *astro = NULL, *import = NULL;
+    for (const char *p = line; (p = md_find(p, end, ".astro\"", 7)) != NULL; ++p) astro = p;
+    if (!astro) return NULL;
+    for (const char *p = line; (p = md_find(p, astro, "import ", 7)) != NULL; ++p) import = p;
+    return import;
+}
+
+static bool md_anchor_exists (const md_parser *parser, const char *anchor, size_t len) {
+    const md_section *sections = (const md_section *)parser->sections->data;
+    for (size_t k = 0; k < parser->nsections; ++k) {
+        if (sections[k].anchor_len == len && memcmp(parser->titles->data + sections[k].anchor, anchor, len) == 0) return true;
+    }
+    return false;
+}
+
+// Records a section starting at position start of the text, heading..end is the heading line after
+// the #s. The title drops the inline markdown, the anchor is its slug (or the custom {#id} of the
+// heading) with a -1, -2... suffix when the page already has the same one, like github does.
+static void md_section_add (md_parser *parser, size_t start, int level, const char *heading, const char *end) {
+    const char *id = NULL, *id_end = NULL;
+    while (end > heading && (unsigned char)end[-1] <= ' ') --end;
+    if (end > heading && end[-1] == '}') {
+        for (ptrdiff_t k = (end - heading) - 2; k >= 0; --k) {
+            if (heading[k] == '{' && heading[k+1] == '#') {
+                id = heading + k + 2;
+                id_end = end - 1;
+                end = heading + k;
+                break;
+            }
+        }
+    }
+    while (end > heading && (unsigned char)end[-1] <= ' ') --end;
+    
+    // optional closing sequence: ## Title ##
+    const char *hashes = end;
+    while (hashes > heading && hashes[-1] == '#') --hashes;
+    if (hashes < end && (hashes == heading || hashes[-1] == ' ')) end = hashes;
+    while (end > heading && (unsigned char)end[-1] <= ' ') --end;
+    
+    size_t len = end - heading;
+    size_t id_len = (id) ? id_end - id : 0;
+    char *titles = scratch_reserve(parser->titles, parser->titles_len + len + ((id_len > len) ? id_len : len) + 32);
+    md_section *section = (md_section *)scratch_reserve(parser->sections, (parser->nsections + 1) * sizeof(md_section));
+    section += parser->nsections;
+    section->start = start;
+    section->level = level;
+    
+    char *title = titles + parser->titles_len;
+    size_t n = 0;
+    for (const char *p = heading; p < end; ++p) {
+        char c = *p;
+        if (c == '*' || c == '`' || c == '[' || c == ']') continue;
+        if (c == '(' && p > heading && p[-1] == ']') {
+            // target of a link
+            const char *close = memchr(p, ')', end - p);
+            if (close) {
+                p = close;
+                continue;
+            }
+        }
+        title[n++] = ((unsigned char)c < ' ') ? ' ' : c;
+    }
+    section->title = parser->titles_len;
+    section->title_len = n;
+    
+    char *anchor = title + n;
+    size_t a = 0;
+    const char *slug = (id) ? id : title, *slug_end = (id) ? id_end : title + n;
+    for (const char *p = slug; p < slug_end; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (!id && c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if (!id && c == ' ') c = '-';
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c >= 0x80) anchor[a++] = c;
+    }
+    if (a == 0) a = (size_t)sprintf(anchor, "section");
+    size_t base = a;
+    for (int k = 1; md_anchor_exists(parser, anchor, a); ++k) a = base + (size_t)sprintf(anchor + base, "-%d", k);
+    section->anchor = parser->titles_len + n;
+    section->anchor_len = a;
+    
+    parser->titles_len += n + a;
+    ++parser->nsections;
+}
+
+// writes the json escape of a control character, the short form when there is one
+static size_t json_escape_control (char *out, int c) {
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    switch (c) {
+        case '\n': out[1] = 'n'; return 2;
+        case '\r': out[1] = 'r'; return 2;
+        case '\t': out[1] = 't'; return 2;
+        case '\b': out[1] = 'b'; return 2;
+        case '\f': out[1] = 'f'; return 2;
+    }
+    memcpy(out + 1, "u00", 3);
+    out[4] = hex[(c >> 4) & 0xf];
+    out[5] = hex[c & 0xf];
+    return 6;
+}
+
+// copy of a short string (url, database name) escaped for a SQL string literal and/or a JSON string, NUL terminated
+static const char *escape_string (const char *s, bool sql, bool json, scratch_buffer *output) {
+    size_t size = 1;
+    for (const char *p = s; *p; ++p) {
+        if (json && (unsigned char)*p < 0x20) size += 6;
+        else size += ((sql && *p == '\'') || (json && (*p == '"' || *p == '\\'))) ? 2 : 1;
+    }
+    
+    char *b = scratch_reserve(output, size);
+    size_t j = 0;
+    for (const char *p = s; *p; ++p) {
+        if (json && (unsigned char)*p < 0x20) {
+            j += json_escape_control(b + j, *p);
+            continue;
+        }
+        if (sql && *p == '\'') b[j++] = '\'';
+        else if (json && (*p == '"' || *p == '\\')) b[j++] = '\\';
+        b[j++] = *p;
+    }
+    b[j] = 0;
+    return b;
+}
+
+// copy of s[0..len) escaped like the text of the page, control characters must already be replaced
+static const char *escape_text (const docbuilder_options *options, const char *s, size_t len, scratch_buffer *output) {
+    char *b = scratch_reserve(output, len * 2 + 1);
+    size_t j = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] == '\'' && options->sql_escape) b[j++] = '\'';
+        else if ((s[i] == '"' || s[i] == '\\') && options->json_escape) b[j++] = '\\';
+        b[j++] = s[i];
+    }
+    b[j] = 0;
+    return b;
+}
+
+// Exact upper bound of the text written by process_md for input[0..len): every byte is counted with
+// the escapes of all the layers it goes through (SQL string literal, then JSON string).
+static size_t md_escaped_size (const docbuilder_options *options, const char *input, size_t len) {
+    unsigned char extra[256] = {0};
+    if (options->json_strict) {
+        for (int c = 0; c < 0x20; ++c) extra[c] = 5;
+        extra['\n'] = extra['\r'] = extra['\b'] = extra['\f'] = 1;
+        // tabulations are replaced with spaces
+        extra['\t'] = 0;
+    }
+    if (options->sql_escape) extra['\''] = 1;
+    if (options->json_escape) extra['"'] = extra['\\'] = 1;
+    
+    size_t size = len;
+    for (size_t i = 0; i < len; ++i) size += extra[(unsigned char)input[i]];
+    return size;
+}
 
-    int i = 0, j = 0, quotes = 0;
+// Parses input[0..len) appending the searchable text to buffer (at most 2 bytes for each input byte,
+// 6 with json_strict, see md_escaped_size) and the front matter to the parser header. When eof is false the bytes that need more lookahead are
+// left unconsumed, the return value is the number of consumed bytes and the caller must pass the
+// remaining ones again, followed by more input. When eof is true input must be followed by two NUL bytes.
+static size_t process_md (const docbuilder_options *options, md_parser *parser, const char *input, size_t len, bool eof, char *buffer, size_t *buffer_len) {
 
-    astro_header[j++] = '\n';
-    astro_header[j++] = '{';
-    astro_header[j++] = '\n';
-    astro_header[j++] = '\\';
-    astro_header[j++] = '\"';
+    bool is_code = parser->is_code;
+    int toskip = parser->toskip;
+    int nskip = parser->nskip;
+    size_t i = 0, j = 0;
+    size_t limit = (eof) ? len : ((len > MD_LOOKAHEAD) ? len - MD_LOOKAHEAD : 0);
     
-    while (input[i]) {
+    md_scan_set set;
+    if (scanner.text) md_scan_set_init(options, &set);
+    
+    while (i < limit && !parser->done) {
+        if (scanner.text && i > 0) {
+            if (toskip == NO_SKIP) {
+                // copy the run of ordinary text up to the next byte that needs the parser
+                size_t end = scanner.text(&set, input, i, limit);
+                memcpy(buffer + j, input + i, end - i);
+                j += end - i;
+                i = end;
+            } else if (nskip == 1) {
+                // the skipped bytes don't change the state, jump to the end of the block
+                i = scanner.skip(input, i, limit, (char)toskip);
+            }
+            if (i >= limit) break;
+        }
+        if (PEEK == 0) {
+            // like a C string the page ends at the first NUL byte
+            parser->done = true;
+            break;
+        }
         int c = NEXT;
+        
+        if (toskip != NO_SKIP) {
+            if (c == toskip) {
+                if (nskip == 1) {
+                    RESET_SKIP();
+                } else if (nskip == 3) {
+                    if((PEEK == toskip) && (PEEK2 == toskip)){
+                        i += 3; // --\n
+                        RESET_SKIP();
+                        if (i > len) {
+                            i = len;
+                            parser->done = true;
+                        }
+                    } else if( ((PREV != toskip) && (PEEK != toskip)) || ((PREV != toskip) && (PREV2 != toskip)) ) md_header_add(parser, c);
+                }
+            } else if(toskip == '-' && nskip == 3) {
+                if (c == '\n' && PEEK == 's' && (PEEK2 == 'l' || PEEK2 == 't')) {
+                    bool found = false;
+                    const char *line_end = md_line_end(input, i, len, eof, &found);
+                    if (!line_end) {
+                        // wait for the rest of the line
+                        --i;
+                        goto parse_suspend;
+                    }
+                    const char *line = &input[i-1];
+                    if(options->path_using_slug && !parser->has_slug && found && line + 7 <= line_end && memcmp(line, "\nslug: ", 7) == 0) {
+                        size_t slug_len = line_end - (line + 7);
+                        memcpy(scratch_reserve(parser->slug, slug_len + 1), line + 7, slug_len);
+                        parser->slug->data[slug_len] = 0;
+                        parser->slug_len = slug_len;
+                        parser->has_slug = true;
+                    }
+                    if(options->use_front_matter && line + 8 <= line_end && memcmp(line, "\nstatus:", 8) == 0 && md_find(line + 8, line_end, "draft", 5)){
+                        parser->is_draft = true;
+                        parser->done = true;
+                        goto parse_suspend;
+                    }
+                }
+                md_header_add(parser, c);
+            }
+            continue;
+        }
                 
         switch (c) {
-            case ':': {
-                if(PEEK == ' ' && quotes == 0){
-                    astro_header[j++] = '\\';
-                    astro_header[j++] = '\"';
-                    astro_header[j++] = ':';
-                    astro_header[j++] = ' ';
-                    NEXT; //skip the space
-                    astro_header[j++] = '\\';
-                    astro_header[j++] = '\"';
-                    continue;
+            case '#': {
+                // a #, ## or ### heading at the start of a line (outside code blocks) starts a new section
+                if (parser->sections && !is_code && (parser->offset + i == 1 || PREV == '\n')) {
+                    size_t level = 1;
+                    while (level < 4 && input[i-1+level] == '#') ++level;
+                    if (level < 4 && input[i-1+level] == ' ') {
+                        bool found = false;
+                        const char *line_end = md_line_end(input, i, len, eof, &found);
+                        if (!line_end) {
+                            // wait for the rest of the line
+                            --i;
+                            goto parse_suspend;
+                        }
+                        md_section_add(parser, j, (int)level, &input[i+level], line_end);
+                    }
                 }
-                break;
+                if (options->strip_md_title == false) break;
+                SET_SKIP('\n');
+                continue;
+            }
+                
+            case '!': {
+                SET_SKIP('\n');
+                continue;
+            }
+                
+            case '<': {
+                if (options->strip_html == false) break;
+                SET_SKIP('>');
+                continue;
+            }
+                
+            case '{': {
+                if (options->strip_jsx == false) break;
+                SET_SKIP('}');
+                continue;
             }
+                
+            case '[':
+            case ']':
+            case '*': {
+                // skip character
+                continue;
+            }
+            
             case '\n': {
-                if(PEEK && PEEK != ' ' && PEEK != '\n' && i > 1){
-                    astro_header[j++] = '\\';
-                    astro_header[j++] = '\"';
-                    astro_header[j++] = ',';
-                    astro_header[j++] = '\n';
-                    astro_header[j++] = '\\';
-                    astro_header[j++] = '\"';
+                // remove double \n
+                if (PEEK == '\n') continue;
+                if (options->json_strict) {
+                    j += json_escape_control(buffer + j, c);
+                    continue;
                 }
-                quotes = 0;
-                continue;
+                break;
             }
+                
+            case '"':
             case '\\': {
-                astro_header[j++] = '\\';
+                if (options->json_escape) buffer[j++] = '\\';
                 break;
             }
-            case '\'': {
-                quotes++;
-                astro_header[j++] = c;
+
+            case '\t': {
+                // replace tabulations with spaces
+                if (options->json_mode){
+                    if(PEEK == '\t'){
+                        continue;
+                    } else {
+                        c = ' ';
+                    }
+                }
                 break;
             }
-            case '\"': {
-                quotes++;
-                continue;
+
+            case ' ': {
+                // remove multiple spaces, space_run is the position where the current run continues
+                size_t position = parser->offset + i - 1;
+                if (position == parser->space_run) {
+                    parser->space_run = position + 1;
+                    continue;
+                }
+                if (PEEK == ' ') parser->space_run = position + 1;
+                break;
             }
-            case '[':
-            case ']':
-            case '\t': {
-                // skip character
+                
+            case 'i': {
+                if (options->strip_jsx == false) break;
+                // remove import jsx statement
+                if ((PEEK == 'm') && (PEEK2 == 'p')) {
+                    // the line is classified once, the next "imp" of the same line reuse the result
+                    size_t position = parser->offset + i - 1;
+                    if (position >= parser->line_end) {
+                        bool found = false;
+                        const char *line_end = md_line_end(input, i, len, eof, &found);
+                        if (!line_end) {
+                            // wait for the rest of the line
+                            --i;
+                            goto parse_suspend;
+                        }
+                        const char *import = md_find_import(&input[i-1], line_end);
+                        parser->line_end = parser->offset + (line_end - input);
+                        parser->import_at = (import) ? parser->offset + (import - input) : SIZE_MAX;
+                    }
+                    if (parser->import_at != SIZE_MAX && position <= parser->import_at) {
+                        SET_SKIP('\n');
+                        continue;
+                    }
+                }
+                break;
+            }
+                
+            case '`': {
+                // check peek and peek2
+                if ((PEEK == '`') && (PEEK2 == '`')) {
+                    is_code = !is_code;
+                    SET_SKIP('\n');
+                    continue;
+                }
+                break;
+            }
+                
+            case '\'': {
+                if (options->sql_escape == false) break;
+                // escape single character
+                buffer[j++] = '\'';
+                buffer[j++] = '\'';
                 continue;
             }
+                
+            case '(': {
+                if ((PEEK == 'h') || (PEEK == '\\')) {
+                    SET_SKIP(')');
+                    continue;
+                }
+                break;
+            }
+                
+            case '-': {
+                if ((PEEK == '-') && (PEEK2 == '-') && options->use_front_matter) {
+                    if (parser->offset + i == 1) {
+                        // process meta
+                        SET_SKIP_N('-', 3);
+                    } else {
+                        SET_SKIP('\n');
+                    }
+                    continue;
+                }
+                break;
+            }
+                
+            default: {
+                // a json string can't contain raw control characters
+                if (options->json_strict && (unsigned char)c < 0x20) {
+                    j += json_escape_control(buffer + j, c);
+                    continue;
+                }
+            }
+        }
+        
+        // copy character as-is
+        buffer[j++] = c;
+    }
+    
+parse_suspend:
+    if (eof && !parser->done && i >= len) parser->done = true;
+    
+    // remember the last two consumed bytes for PREV and PREV2
+    if (i >= 2) {
+        parser->last[0] = input[i-1];
+        parser->last[1] = input[i-2];
+    } else if (i == 1) {
+        parser->last[1] = parser->last[0];
+        parser->last[0] = input[0];
+    }
+    
+    parser->offset += i;
+    parser->is_code = is_code;
+    parser->toskip = toskip;
+    parser->nskip = nskip;
+    
+    buffer[j] = 0;
+    *buffer_len = j;
+    if (parser->header_len + 1 > parser->header->capacity) scratch_reserve(parser->header, parser->header_len + 1);
+    parser->header->data[parser->header_len] = 0;
+    return i;
+}
+
+// MARK: - Front Matter -
+
+// The front matter collected by process_md is a YAML subset: block mappings and sequences by indentation, flow [..]
+// and {..} collections, single and double quoted scalars, | and > block scalars and multi-line plain scalars. It is
+// converted to compact JSON in a single pass over the header (no newline, so it is valid in every output format),
+// each byte is escaped with the layers of the output while it is written: none when bound to the database, quotes
+// doubled in a SQL string literal and escaped in a JSON string. Plain true, false, null and numbers keep their type.
+// The value of a --fts-front-matter key is written as text to fields too, a list or a mapping as its items.
+typedef struct {
+    const char      *s;
+    size_t          len;
+    size_t          line;           // start of the current line
+    size_t          pos;            // first char of the current line, or of the item of a sequence
+    int             indent;         // column of pos, -1 at the end of the front matter
+    scratch_buffer  *out;           // NULL when only the fields are needed
+    size_t          out_len;
+    bool            sql_escape;
+    bool            json_escape;
+    const docbuilder_options *options;
+    doc_entry       *entry;         // field_start and field_len of the front matter columns
+    scratch_buffer  *fields;
+    size_t          fields_len;
+    int             column;         // column of the value being written, -1 otherwise
+    int             depth;          // of the mappings, 1 is the root
+} fm_parser;
+
+static void fm_node (fm_parser *p);
+
+// writes a char of the json text, at most 2 bytes with the escapes of the output
+static void fm_put (fm_parser *p, char c) {
+    if (!p->out) return;
+    char *b = scratch_reserve(p->out, p->out_len + 3);
+    if (c == '\'' && p->sql_escape) b[p->out_len++] = '\'';
+    else if ((c == '"' || c == '\\') && p->json_escape) b[p->out_len++] = '\\';
+    b[p->out_len++] = c;
+}
+
+static void fm_puts (fm_parser *p, const char *s, size_t len) {
+    for (size_t i = 0; i < len; ++i) fm_put(p, s[i]);
+}
+
+// text of a front matter column, a control character is a space
+static void fm_capture (fm_parser *p, const char *s, size_t len) {
+    if (p->column < 0) return;
+    char *b = scratch_reserve(p->fields, p->fields_len + len * 2 + 1);
+    for (size_t i = 0; i < len; ++i) {
+        char c = ((unsigned char)s[i] < 0x20) ? ' ' : s[i];
+        if (c == '\'' && p->sql_escape) b[p->fields_len++] = '\'';
+        else if ((c == '"' || c == '\\') && p->json_escape) b[p->fields_len++] = '\\';
+        b[p->fields_len++] = c;
+    }
+}
+
+// separator of the json text, the items of a captured list or mapping are separated by ", " and ": "
+static void fm_separator (fm_parser *p, char c) {
+    fm_put(p, c);
+    fm_capture(p, (c == ',') ? ", " : ": ", 2);
+}
+
+// writes a byte of a json string
+static void fm_char (fm_parser *p, unsigned char c) {
+    fm_capture(p, (const char *)&c, 1);
+    if (c < 0x20) {
+        char escape[6];
+        fm_puts(p, escape, json_escape_control(escape, c));
+        return;
+    }
+    if (c == '"' || c == '\\') fm_put(p, '\\');
+    fm_put(p, (char)c);
+}
+
+static void fm_string (fm_parser *p, size_t start, size_t end) {
+    fm_put(p, '"');
+    for (size_t i = start; i < end; ++i) fm_char(p, (unsigned char)p->s[i]);
+    fm_put(p, '"');
+}
+
+static bool fm_space (char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool fm_digit (char c) {
+    return c >= '0' && c <= '9';
+}
+
+static size_t fm_eol (const fm_parser *p, size_t i) {
+    while (i < p->len && p->s[i] != '\n') ++i;
+    return i;
+}
+
+// end of a plain scalar on its line: before a comment and the trailing spaces
+static size_t fm_plain_end (const fm_parser *p, size_t start) {
+    size_t end = start;
+    while (end < p->len && p->s[end] != '\n' && !(p->s[end] == '#' && end > start && fm_space(p->s[end - 1]))) ++end;
+    while (end > start && (fm_space(p->s[end - 1]) || p->s[end - 1] == '\r')) --end;
+    return end;
+}
+
+// moves to the first line with content from the line that starts at i, blank and comment lines are skipped
+static void fm_seek (fm_parser *p, size_t i) {
+    while (i < p->len) {
+        size_t j = i;
+        while (j < p->len && fm_space(p->s[j])) ++j;
+        if (j < p->len && p->s[j] != '\n' && p->s[j] != '\r' && p->s[j] != '#') {
+            p->line = i;
+            p->pos = j;
+            p->indent = (int)(j - i);
+            return;
+        }
+        i = fm_eol(p, j) + 1;
+    }
+    p->line = p->pos = p->len;
+    p->indent = -1;
+}
+
+static void fm_next_line (fm_parser *p, size_t i) {
+    fm_seek(p, fm_eol(p, i) + 1);
+}
+
+static bool fm_is_item (const fm_parser *p, size_t i) {
+    return p->s[i] == '-' && (i + 1 == p->len || fm_space(p->s[i + 1]) || p->s[i + 1] == '\n' || p->s[i + 1] == '\r');
+}
+
+// end of the quoted scalar that starts at i (after the closing quote)
+static size_t fm_quoted_end (const fm_parser *p, size_t i) {
+    char q = p->s[i++];
+    while (i < p->len) {
+        if (p->s[i] == '\\' && q == '"') i += 2;
+        else if (p->s[i] == q && q == '\'' && i + 1 < p->len && p->s[i + 1] == '\'') i += 2;
+        else if (p->s[i++] == q) break;
+    }
+    return (i < p->len) ? i : p->len;
+}
+
+// "key: value" on the current line, value is the first char after the colon
+static bool fm_is_key (const fm_parser *p, size_t *key_end, size_t *value) {
+    size_t i = p->pos, eol = fm_eol(p, i);
+    char c = p->s[i];
+    if (c == '[' || c == '{' || c == '|' || c == '>' || fm_is_item(p, i)) return false;
+    if (c == '"' || c == '\'') {
+        i = fm_quoted_end(p, i);
+        if (i > eol) return false;
+        *key_end = i;
+        while (i < eol && fm_space(p->s[i])) ++i;
+        if (i == eol || p->s[i] != ':') return false;
+    } else {
+        while (i < eol && !(p->s[i] == ':' && (i + 1 == eol || fm_space(p->s[i + 1]) || p->s[i + 1] == '\r'))) {
+            if (p->s[i] == '#' && i > p->pos && fm_space(p->s[i - 1])) return false;
+            ++i;
+        }
+        if (i == eol) return false;
+        *key_end = i;
+        while (*key_end > p->pos && fm_space(p->s[*key_end - 1])) --*key_end;
+    }
+    *value = i + 1;
+    return true;
+}
+
+static int fm_hex (const char *s, size_t n, uint32_t *value) {
+    *value = 0;
+    for (size_t k = 0; k < n; ++k) {
+        char c = s[k];
+        int d = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (d < 0) return 0;
+        *value = (*value << 4) | (uint32_t)d;
+    }
+    return 1;
+}
+
+// writes a code point of a \x, \u or \U escape as utf-8
+static void fm_codepoint (fm_parser *p, uint32_t c) {
+    if (c < 0x80) {
+        fm_char(p, (unsigned char)c);
+    } else if (c < 0x800) {
+        fm_char(p, (unsigned char)(0xc0 | (c >> 6)));
+        fm_char(p, (unsigned char)(0x80 | (c & 0x3f)));
+    } else if (c < 0x10000) {
+        fm_char(p, (unsigned char)(0xe0 | (c >> 12)));
+        fm_char(p, (unsigned char)(0x80 | ((c >> 6) & 0x3f)));
+        fm_char(p, (unsigned char)(0x80 | (c & 0x3f)));
+    } else if (c < 0x110000) {
+        fm_char(p, (unsigned char)(0xf0 | (c >> 18)));
+        fm_char(p, (unsigned char)(0x80 | ((c >> 12) & 0x3f)));
+        fm_char(p, (unsigned char)(0x80 | ((c >> 6) & 0x3f)));
+        fm_char(p, (unsigned char)(0x80 | (c & 0x3f)));
+    }
+}
+
+// writes the quoted scalar that starts at i as a json string, a line break is folded to a space (a blank line to a
+// newline), returns the position after the closing quote
+static size_t fm_quoted (fm_parser *p, size_t i) {
+    const char *s = p->s;
+    char q = s[i++];
+    
+    fm_put(p, '"');
+    while (i < p->len) {
+        char c = s[i++];
+        if (c == q) {
+            if (q == '\'' && i < p->len && s[i] == '\'') {
+                fm_char(p, '\'');
+                ++i;
+                continue;
+            }
+            break;
+        }
+        if (c == '\r') continue;
+        if (c == '\n') {
+            int breaks = 0;
+            for (;;) {
+                while (i < p->len && (fm_space(s[i]) || s[i] == '\r')) ++i;
+                if (i >= p->len || s[i] != '\n') break;
+                ++breaks;
+                ++i;
+            }
+            if (breaks == 0) fm_char(p, ' ');
+            while (breaks-- > 0) fm_char(p, '\n');
+            continue;
+        }
+        if (c != '\\' || q != '"' || i >= p->len) {
+            fm_char(p, (unsigned char)c);
+            continue;
+        }
+        
+        uint32_t code;
+        c = s[i++];
+        switch (c) {
+            case 'n': fm_char(p, '\n'); break;
+            case 't': case '\t': fm_char(p, '\t'); break;
+            case 'r': fm_char(p, '\r'); break;
+            case 'b': fm_char(p, '\b'); break;
+            case 'f': fm_char(p, '\f'); break;
+            case 'v': fm_char(p, '\v'); break;
+            case 'a': fm_char(p, '\a'); break;
+            case 'e': fm_char(p, 0x1b); break;
+            case '0': fm_char(p, 0); break;
+            case 'N': fm_codepoint(p, 0x85); break;
+            case '_': fm_codepoint(p, 0xa0); break;
+            case 'L': fm_codepoint(p, 0x2028); break;
+            case 'P': fm_codepoint(p, 0x2029); break;
+            case '\r':
+            case '\n':
+                // escaped line break, the indentation of the next line is dropped
+                while (i < p->len && (fm_space(s[i]) || s[i] == '\n' || s[i] == '\r')) ++i;
+                break;
+            case 'x':
+            case 'u':
+            case 'U': {
+                size_t n = (c == 'x') ? 2 : (c == 'u') ? 4 : 8;
+                if (i + n <= p->len && fm_hex(s + i, n, &code)) {
+                    fm_codepoint(p, code);
+                    i += n;
+                    break;
+                }
+                fm_char(p, (unsigned char)c);
+                break;
+            }
+            default: fm_char(p, (unsigned char)c);
+        }
+    }
+    fm_put(p, '"');
+    return i;
+}
+
+// a plain scalar keeps its type when it is true, false, null or a json number
+static void fm_scalar (fm_parser *p, size_t start, size_t end) {
+    const char *s = p->s + start;
+    size_t len = end - start;
+    static const char *literals[] = {"~", "null", "Null", "NULL", "true", "True", "TRUE", "false", "False", "FALSE"};
+    for (size_t k = 0; k < sizeof(literals) / sizeof(literals[0]); ++k) {
+        if (len != strlen(literals[k]) || memcmp(s, literals[k], len) != 0) continue;
+        const char *value = (k < 4) ? "null" : (k < 7) ? "true" : "false";
+        fm_puts(p, value, strlen(value));
+        if (k >= 4) fm_capture(p, s, len);
+        return;
+    }
+    if (len == 0) {
+        fm_puts(p, "null", 4);
+        return;
+    }
+    
+    // -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    size_t i = (s[0] == '-') ? 1 : 0, digits;
+    bool number = i < len && fm_digit(s[i]) && !(s[i] == '0' && i + 1 < len && fm_digit(s[i + 1]));
+    while (i < len && fm_digit(s[i])) ++i;
+    if (number && i < len && s[i] == '.') {
+        for (digits = ++i; i < len && fm_digit(s[i]); ++i);
+        number = i > digits;
+    }
+    if (number && i < len && (s[i] == 'e' || s[i] == 'E')) {
+        if (++i < len && (s[i] == '+' || s[i] == '-')) ++i;
+        for (digits = i; i < len && fm_digit(s[i]); ++i);
+        number = i > digits;
+    }
+    if (number && i == len) {
+        fm_puts(p, s, len);
+        fm_capture(p, s, len);
+    } else {
+        fm_string(p, start, end);
+    }
+}
+
+// a flow collection or scalar, it can span several lines, returns the position after it
+static size_t fm_flow (fm_parser *p, size_t i) {
+    const char *s = p->s;
+    while (i < p->len && (fm_space(s[i]) || s[i] == '\n' || s[i] == '\r')) ++i;
+    if (i >= p->len) {
+        fm_puts(p, "null", 4);
+        return i;
+    }
+    
+    char open = s[i];
+    if (open == '"' || open == '\'') return fm_quoted(p, i);
+    if (open != '[' && open != '{') {
+        size_t start = i;
+        while (i < p->len && s[i] != ',' && s[i] != ']' && s[i] != '}' && s[i] != '\n' && !(s[i] == '#' && fm_space(s[i - 1]))) {
+            if (s[i] == ':' && i + 1 < p->len && (fm_space(s[i + 1]) || s[i + 1] == ',' || s[i + 1] == '}' || s[i + 1] == '\n')) break;
+            ++i;
+        }
+        size_t end = i;
+        while (end > start && (fm_space(s[end - 1]) || s[end - 1] == '\r')) --end;
+        fm_scalar(p, start, end);
+        return i;
+    }
+    
+    char close = (open == '[') ? ']' : '}';
+    bool first = true;
+    fm_put(p, open);
+    ++i;
+    while (i < p->len) {
+        char c = s[i];
+        if (c == close) {
+            ++i;
+            break;
+        }
+        if (fm_space(c) || c == '\n' || c == '\r' || c == ',' || c == ']' || c == '}' || c == ':') {
+            ++i;
+            continue;
+        }
+        if (c == '#') {
+            i = fm_eol(p, i);
+            continue;
+        }
+        if (!first) fm_separator(p, ',');
+        first = false;
+        
+        // a member of a mapping is a string key and a value, null without the colon
+        if (open == '{') {
+            size_t start = i;
+            if (c == '"' || c == '\'') {
+                i = fm_quoted(p, i);
+            } else {
+                while (i < p->len && s[i] != ',' && s[i] != '}' && s[i] != '\n' && !(s[i] == ':' && i + 1 < p->len && (fm_space(s[i + 1]) || s[i + 1] == ',' || s[i + 1] == '}' || s[i + 1] == '\n'))) ++i;
+                size_t end = i;
+                while (end > start && (fm_space(s[end - 1]) || s[end - 1] == '\r')) --end;
+                fm_string(p, start, end);
+            }
+            fm_separator(p, ':');
+            while (i < p->len && fm_space(s[i])) ++i;
+            if (i < p->len && s[i] == ':') i = fm_flow(p, i + 1);
+            else fm_puts(p, "null", 4);
+        } else {
+            i = fm_flow(p, i);
+        }
+    }
+    fm_put(p, close);
+    return i;
+}
+
+// | and > block scalars, the lines more indented than the key; clip, strip (-) or keep (+) the final newlines
+static void fm_block (fm_parser *p, size_t i, int indent) {
+    const char *s = p->s;
+    bool folded = s[i++] == '>';
+    char chomp = 0;
+    int block = 0;
+    for (; i < p->len && s[i] != '\n' && !fm_space(s[i]); ++i) {
+        if (s[i] == '-' || s[i] == '+') chomp = s[i];
+        else if (s[i] >= '1' && s[i] <= '9') block = indent + (s[i] - '0');
+    }
+    
+    size_t line = fm_eol(p, i) + 1;
+    int breaks = 0, lines = 0;
+    bool more_indented = false;
+    fm_put(p, '"');
+    while (line < p->len) {
+        size_t j = line, eol = fm_eol(p, line);
+        while (j < eol && s[j] == ' ') ++j;
+        size_t end = eol;
+        while (end > j && s[end - 1] == '\r') --end;
+        if (j == end) {
+            ++breaks;
+            line = eol + 1;
+            continue;
+        }
+        int n = (int)(j - line);
+        if (block == 0) block = n;
+        if (n < block || n <= indent) break;
+        
+        // a folded line break is a space, unless it is next to a more indented line
+        bool indented = n > block || fm_space(s[j]);
+        bool fold = lines > 0 && folded && !indented && !more_indented;
+        if (fold && breaks == 0) fm_char(p, ' ');
+        for (int k = (lines > 0 && !fold) ? -1 : 0; k < breaks; ++k) fm_char(p, '\n');
+        for (size_t k = line + block; k < end; ++k) fm_char(p, (unsigned char)s[k]);
+        more_indented = indented;
+        breaks = 0;
+        ++lines;
+        line = eol + 1;
+    }
+    if (lines > 0 && chomp != '-') fm_char(p, '\n');
+    if (lines > 0 && chomp == '+') for (int k = 0; k < breaks; ++k) fm_char(p, '\n');
+    fm_put(p, '"');
+    fm_seek(p, (line < p->len) ? line : p->len);
+}
+
+// the value of a key or of an item of a sequence that starts at i on the current line, its continuation lines are
+// more indented than the key; a sequence can have the same indentation of its key
+static void fm_value (fm_parser *p, size_t i, int indent, bool key) {
+    const char *s = p->s;
+    while (i < p->len && fm_space(s[i])) ++i;
+    char c = (i < p->len) ? s[i] : '\n';
+    
+    if (c == '\n' || c == '\r' || c == '#') {
+        fm_next_line(p, i);
+        if (p->indent > indent) fm_node(p);
+        else if (key && p->indent == indent && fm_is_item(p, p->pos)) fm_node(p);
+        else fm_puts(p, "null", 4);
+        return;
+    }
+    if (c == '|' || c == '>') {
+        fm_block(p, i, indent);
+        return;
+    }
+    if (c == '"' || c == '\'' || c == '[' || c == '{') {
+        size_t end = (c == '"' || c == '\'') ? fm_quoted(p, i) : fm_flow(p, i);
+        fm_next_line(p, (end > 0) ? end - 1 : 0);
+        return;
+    }
+    
+    // a plain scalar is folded with its continuation lines
+    size_t end = fm_plain_end(p, i);
+    fm_next_line(p, i);
+    if (p->indent <= indent) {
+        fm_scalar(p, i, end);
+        return;
+    }
+    fm_put(p, '"');
+    for (size_t k = i; k < end; ++k) fm_char(p, (unsigned char)s[k]);
+    while (p->indent > indent) {
+        fm_char(p, ' ');
+        end = fm_plain_end(p, p->pos);
+        for (size_t k = p->pos; k < end; ++k) fm_char(p, (unsigned char)s[k]);
+        fm_next_line(p, p->pos);
+    }
+    fm_put(p, '"');
+}
+
+// index of the --fts-front-matter column of a key of the root mapping, -1 when it has none
+static int fm_column (const fm_parser *p, size_t key_end) {
+    size_t start = p->pos;
+    if (p->depth != 1 || !p->fields) return -1;
+    if (p->s[start] == '"' || p->s[start] == '\'') {
+        ++start;
+        --key_end;
+    }
+    for (int k = 0; k < p->options->nfm_columns; ++k) {
+        const char *name = p->options->fm_columns[k];
+        if (strlen(name) == key_end - start && memcmp(name, p->s + start, key_end - start) == 0) return k;
+    }
+    return -1;
+}
+
+static void fm_mapping (fm_parser *p) {
+    int indent = p->indent;
+    bool first = true;
+    size_t key_end, value;
+    
+    ++p->depth;
+    fm_put(p, '{');
+    while (p->indent >= indent) {
+        // lines that don't belong to the mapping are skipped
+        if (p->indent > indent || !fm_is_key(p, &key_end, &value)) {
+            fm_next_line(p, p->pos);
+            continue;
+        }
+        if (!first) fm_separator(p, ',');
+        first = false;
+        int column = fm_column(p, key_end);
+        if (p->s[p->pos] == '"' || p->s[p->pos] == '\'') fm_quoted(p, p->pos);
+        else fm_string(p, p->pos, key_end);
+        fm_separator(p, ':');
+        
+        // the text of the value is the field of its column, a null or empty value is NULL
+        if (column >= 0) {
+            p->column = column;
+            p->entry->field_start[column] = p->fields_len;
+        }
+        fm_value(p, value, indent, true);
+        if (column >= 0) {
+            // the final newline of a block scalar is dropped
+            size_t len = p->fields_len - p->entry->field_start[column];
+            while (len > 0 && p->fields->data[p->entry->field_start[column] + len - 1] == ' ') --len;
+            p->entry->field_len[column] = (len) ? len : FIELD_NULL;
+            p->column = -1;
+        }
+    }
+    fm_put(p, '}');
+    --p->depth;
+}
+
+static void fm_sequence (fm_parser *p) {
+    int indent = p->indent;
+    bool first = true;
+    size_t key_end, value;
+    
+    fm_put(p, '[');
+    while (p->indent >= indent) {
+        if (p->indent == indent && !fm_is_item(p, p->pos)) break;
+        if (p->indent > indent) {
+            fm_next_line(p, p->pos);
+            continue;
+        }
+        if (!first) fm_separator(p, ',');
+        first = false;
+        
+        // a nested mapping or sequence on the line of the dash starts at the column of its first char
+        size_t i = p->pos + 1;
+        while (i < p->len && fm_space(p->s[i])) ++i;
+        size_t pos = p->pos;
+        p->pos = i;
+        if (i < p->len && (fm_is_item(p, i) || fm_is_key(p, &key_end, &value))) {
+            p->indent = (int)(i - p->line);
+            fm_node(p);
+        } else {
+            p->pos = pos;
+            fm_value(p, i, indent, false);
+        }
+    }
+    fm_put(p, ']');
+}
+
+static void fm_node (fm_parser *p) {
+    size_t key_end, value;
+    if (fm_is_item(p, p->pos)) fm_sequence(p);
+    else if (fm_is_key(p, &key_end, &value)) fm_mapping(p);
+    else fm_value(p, p->pos, p->indent - 1, false);
+}
+
+// converts the front matter (header_len bytes) to a json object, NUL terminated, *json_len is its size. The values
+// of the --fts-front-matter keys are written to fields and their position to entry, a NULL output skips the json
+static char *process_front_matter (const docbuilder_options *options, const char *header, size_t header_len, scratch_buffer *output, size_t *json_len, scratch_buffer *fields, doc_entry *entry) {
+    fm_parser p = {.s = header, .len = header_len, .out = output, .sql_escape = options->sql_escape, .json_escape = options->json_escape,
+                   .options = options, .entry = entry, .fields = (options->nfm_columns) ? fields : NULL, .column = -1};
+    for (int k = 0; k < options->nfm_columns; ++k) entry->field_len[k] = FIELD_NULL;
+    
+    // the root is always an object, whatever is not a key: value of the first indentation is skipped
+    fm_seek(&p, 0);
+    if (p.indent < 0) fm_puts(&p, "{}", 2);
+    else fm_mapping(&p);
+    if (p.fields) entry->fields = scratch_reserve(fields, p.fields_len + 1);
+    if (!output) return NULL;
+    
+    char *json = scratch_reserve(output, p.out_len + 1);
+    json[p.out_len] = 0;
+    *json_len = p.out_len;
+    return json;
+}
+
+// MARK: - Compression -
+
+// With --compress=gzip|zstd[:level] the sql file is compressed by the writer thread while it is written
+// and each uploaded request body is sent compressed (Content-Encoding), no uncompressed copy of the
+// statements is ever stored. Every request is a complete gzip member or zstd frame.
+
+#define COMPRESS_CHUNK              (64*1024)
+
+static const char *compress_name (compress_format format) {
+    return (format == COMPRESS_GZIP) ? "gzip" : (format == COMPRESS_ZSTD) ? "zstd" : "none";
+}
+
+// gzip[:level] or zstd[:level], false when the format is unknown, not available or the level is out of range
+static bool compress_parse (const char *value, docbuilder_options *options) {
+    const char *colon = strchr(value, ':');
+    size_t len = (colon) ? (size_t)(colon - value) : strlen(value);
+    int level = (colon) ? atoi(colon + 1) : -1;
+    
+    if (len == 4 && strncmp(value, "gzip", 4) == 0) {
+        #if ENABLE_GZIP
+        if (colon && (level < 0 || level > 9)) return false;
+        options->compress = COMPRESS_GZIP;
+        #else
+        printf("The gzip compression is not available, build with -DENABLE_GZIP=1 -lz.");
+        exit(-1);
+        #endif
+    } else if (len == 4 && strncmp(value, "zstd", 4) == 0) {
+        #if ENABLE_ZSTD
+        if (colon && (level < 1 || level > ZSTD_maxCLevel())) return false;
+        options->compress = COMPRESS_ZSTD;
+        #else
+        printf("The zstd compression is not available, build with -DENABLE_ZSTD=1 -lzstd.");
+        exit(-1);
+        #endif
+    } else {
+        return false;
+    }
+    options->compress_level = level;
+    return true;
+}
+
+static compressor *compressor_create (compress_format format, int level) {
+    if (format == COMPRESS_NONE) return NULL;
+    compressor *c = (compressor *)calloc(1, sizeof(compressor));
+    if (!c) {
+        printf("Not enough memory to allocate %zu bytes.", sizeof(compressor));
+        exit(-3);
+    }
+    c->format = format;
+    
+    bool ok = false;
+    #if !ENABLE_GZIP && !ENABLE_ZSTD
+    (void)level;
+    #endif
+    #if ENABLE_GZIP
+    // 16 + 15 bits window: gzip header and trailer
+    if (format == COMPRESS_GZIP) ok = (deflateInit2(&c->zs, (level < 0) ? Z_DEFAULT_COMPRESSION : level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    #endif
+    #if ENABLE_ZSTD
+    if (format == COMPRESS_ZSTD) {
+        c->zstd = ZSTD_createCCtx();
+        ok = (c->zstd && !ZSTD_isError(ZSTD_CCtx_setParameter(c->zstd, ZSTD_c_compressionLevel, (level < 0) ? ZSTD_CLEVEL_DEFAULT : level)));
+    }
+    #endif
+    if (!ok) {
+        printf("Unable to initialize the %s compression.", compress_name(format));
+        exit(-3);
+    }
+    return c;
+}
+
+static void compressor_free (compressor *c) {
+    if (!c) return;
+    #if ENABLE_GZIP
+    if (c->format == COMPRESS_GZIP) deflateEnd(&c->zs);
+    #endif
+    #if ENABLE_ZSTD
+    if (c->format == COMPRESS_ZSTD) ZSTD_freeCCtx(c->zstd);
+    #endif
+    free(c);
+}
+
+// compresses len bytes appending the output to out after *out_len, finish ends the gzip member (or the
+// zstd frame) and the next call starts a new one
+static void compressor_write (compressor *c, const char *data, size_t len, bool finish, scratch_buffer *out, size_t *out_len) {
+    bool ok = true;
+    
+    #if !ENABLE_GZIP && !ENABLE_ZSTD
+    (void)data; (void)len; (void)finish; (void)out; (void)out_len;
+    #endif
+    #if ENABLE_GZIP
+    if (c->format == COMPRESS_GZIP) {
+        c->zs.next_in = (Bytef *)data;
+        c->zs.avail_in = (uInt)len;
+        int rc;
+        do {
+            char *p = scratch_reserve(out, *out_len + COMPRESS_CHUNK) + *out_len;
+            c->zs.next_out = (Bytef *)p;
+            c->zs.avail_out = COMPRESS_CHUNK;
+            rc = deflate(&c->zs, (finish) ? Z_FINISH : Z_NO_FLUSH);
+            *out_len += COMPRESS_CHUNK - c->zs.avail_out;
+        } while (rc == Z_OK && (finish || c->zs.avail_out == 0));
+        ok = (finish) ? (rc == Z_STREAM_END && deflateReset(&c->zs) == Z_OK) : (rc == Z_OK || rc == Z_BUF_ERROR);
+    }
+    #endif
+    #if ENABLE_ZSTD
+    if (c->format == COMPRESS_ZSTD) {
+        ZSTD_inBuffer in = {data, len, 0};
+        size_t remaining;
+        do {
+            size_t size = ZSTD_CStreamOutSize();
+            ZSTD_outBuffer o = {scratch_reserve(out, *out_len + size) + *out_len, size, 0};
+            remaining = ZSTD_compressStream2(c->zstd, &o, &in, (finish) ? ZSTD_e_end : ZSTD_e_continue);
+            *out_len += o.pos;
+            if (ZSTD_isError(remaining)) break;
+        } while ((finish) ? remaining != 0 : in.pos < in.size);
+        ok = !ZSTD_isError(remaining);
+    }
+    #endif
+    
+    if (!ok) {
+        printf("Unable to compress the output (%s).", compress_name(c->format));
+        exit(-6);
+    }
+}
+
+// MARK: - Stats -
+// Without --stats the clocks are never read, every stats_ function returns after a single test.
+
+static stats_time stats_now (const docbuilder_options *options) {
+    stats_time t = {0, 0};
+    if (!options->stats_path) return t;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t.wall = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    t.cpu = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    return t;
+}
+
+// adds the time since start to total (when not NULL) and restarts the clock
+static void stats_lap (const docbuilder_options *options, stats_time *total, stats_time *start) {
+    if (!options->stats_path) return;
+    stats_time now = stats_now(options);
+    if (total) {
+        total->wall += now.wall - start->wall;
+        total->cpu += now.cpu - start->cpu;
+    }
+    *start = now;
+}
+
+static void stats_time_add (stats_time *total, const stats_time *t) {
+    total->wall += t->wall;
+    total->cpu += t->cpu;
+}
+
+// keeps the STATS_TOP files with the largest size (or wall time) in descending order
+static void stats_rank (stats_file *top, const stats_file *file, const char *path, bool by_size) {
+    int i = STATS_TOP;
+    while (i > 0 && ((by_size) ? file->bytes_in > top[i-1].bytes_in : file->wall > top[i-1].wall)) --i;
+    if (i == STATS_TOP) return;
+    
+    free(top[STATS_TOP-1].path);
+    memmove(&top[i+1], &top[i], (STATS_TOP - 1 - i) * sizeof(stats_file));
+    top[i] = *file;
+    top[i].path = strdup(path);
+    if (!top[i].path) exit(-11);
+}
+
+static void stats_add_entry (const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry, bool alias) {
+    if (!options->stats_path) return;
+    docbuilder_stats *stats = &output->stats;
+    
+    stats_time_add(&stats->read, &entry->stats.read);
+    stats_time_add(&stats->parse, &entry->stats.parse);
+    stats_time_add(&stats->json, &entry->stats.json);
+    stats_time_add(&stats->write, &entry->stats.write);
+    
+    if (!entry->path) ++stats->unreadable;
+    else if (entry->unchanged) ++stats->unchanged;
+    else if (entry->skip) ++stats->drafts;
+    else if (alias) ++stats->deduplicated;
+    else ++stats->indexed;
+    if (!entry->path || entry->unchanged) return;
+    if (entry->streamed) ++stats->streamed;
+    
+    stats_file file = {NULL, entry->fsize, (entry->skip) ? 0 : entry->size + entry->header_size, 0};
+    file.wall = entry->stats.read.wall + entry->stats.parse.wall + entry->stats.json.wall + entry->stats.write.wall;
+    stats->bytes_in += (uint64_t)file.bytes_in;
+    stats->bytes_out += file.bytes_out;
+    stats_rank(stats->largest, &file, entry->path, true);
+    stats_rank(stats->slowest, &file, entry->path, false);
+}
+
+static void stats_write_time (FILE *f, const char *name, const stats_time *t, bool last) {
+    fprintf(f, "    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}%s\n", name, (double)t->wall / 1e6, (double)t->cpu / 1e6, (last) ? "" : ",");
+}
+
+static void stats_write_files (FILE *f, const char *name, const stats_file *top, scratch_buffer *scratch) {
+    fprintf(f, "  \"%s\": [", name);
+    for (int i = 0; i < STATS_TOP && top[i].path; ++i) {
+        fprintf(f, "%s\n    {\"path\": \"%s\", \"bytes_in\": %lld, \"bytes_out\": %zu, \"wall_ms\": %.3f}", (i) ? "," : "",
+                escape_string(top[i].path, false, true, scratch), (long long)top[i].bytes_in, top[i].bytes_out, (double)top[i].wall / 1e6);
+    }
+    fprintf(f, "\n  ]");
+}
+
+// the json file of --stats, the times of read, parse and json are summed over the threads
+static void stats_write (const docbuilder_options *options, docbuilder_output *output) {
+    if (!options->stats_path) return;
+    docbuilder_stats *stats = &output->stats;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double wall = (double)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec - stats->start.wall) / 1e6;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+    
+    FILE *f = fopen(options->stats_path, "w");
+    if (!f) {
+        printf("Unable to create stats file :%s.", options->stats_path);
+        exit(-2);
+    }
+    
+    fprintf(f, "{\n  \"version\": \"%s\",\n  \"threads\": %d,\n  \"read_ahead\": %d,\n  \"compress\": \"%s\",\n", DOCBUILDER_VERSION, options->nthreads, stats->read_ahead, compress_name(options->compress));
+    fprintf(f, "  \"wall_ms\": %.3f,\n  \"cpu_ms\": %.3f,\n  \"peak_rss_kb\": %ld,\n", wall, cpu, usage.ru_maxrss);
+    fprintf(f, "  \"phases\": {\n");
+    stats_write_time(f, "walk", &stats->walk, false);
+    stats_write_time(f, "read", &stats->read, false);
+    stats_write_time(f, "parse", &stats->parse, false);
+    stats_write_time(f, "json", &stats->json, false);
+    stats_write_time(f, "write", &stats->write, false);
+    stats_write_time(f, "upload", &stats->upload, false);
+    stats_write_time(f, "finish", &stats->finish, true);
+    fprintf(f, "  },\n  \"files\": {\"indexed\": %zu, \"streamed\": %zu, \"deduplicated\": %zu, \"unchanged\": %zu, \"drafts\": %zu, \"unreadable\": %zu, \"not_markdown\": %zu},\n",
+            stats->indexed, stats->streamed, stats->deduplicated, stats->unchanged, stats->drafts, stats->unreadable, stats->not_markdown);
+    fprintf(f, "  \"bytes_in\": %llu,\n  \"bytes_out\": %llu,\n  \"mb_s\": %.2f,\n", (unsigned long long)stats->bytes_in, (unsigned long long)stats->bytes_out,
+            (wall > 0) ? (double)stats->bytes_in / 1048576.0 / (wall / 1e3) : 0.0);
+    
+    scratch_buffer scratch = {0};
+    stats_write_files(f, "largest", stats->largest, &scratch);
+    fprintf(f, ",\n");
+    stats_write_files(f, "slowest", stats->slowest, &scratch);
+    fprintf(f, "\n}\n");
+    scratch_free(&scratch);
+    
+    if (fclose(f) != 0) {
+        printf("Write fails: %s.", options->stats_path);
+        exit(-6);
+    }
+    for (int i = 0; i < STATS_TOP; ++i) {
+        free(stats->largest[i].path);
+        free(stats->slowest[i].path);
+    }
+}
+
+// MARK: - FTS5 Schema -
+// The internal layout is a single FTS5 table. The external layout stores the rows in documentation_rows and
+// the triggers keep the FTS5 index in sync, the contentless layout stores only the index of the text (no snippets
+// or highlights) and the rows are written to the documentation_input view.
+
+
+// table written by the INSERT and DELETE statements
+static const char *fts_target (const docbuilder_options *options) {
+    if (options->fts_content == FTS_CONTENT_EXTERNAL) return "documentation_rows";
+    if (options->fts_content == FTS_CONTENT_NONE) return "documentation_input";
+    return "documentation";
+}
+
+// columns of the documentation table, options holds the front matter, section_title the heading of a section
+// and the --fts-front-matter keys have a column each
+static int table_column_list (const docbuilder_options *options, const char *columns[TABLE_COLUMNS_MAX]) {
+    int n = 0;
+    columns[n++] = "url";
+    columns[n++] = "content";
+    if (OPTIONS_COL(options)) columns[n++] = "options";
+    if (options->split_sections) columns[n++] = "section_title";
+    for (int k = 0; k < options->nfm_columns; ++k) columns[n++] = options->fm_columns[k];
+    return n;
+}
+
+// --fts-front-matter keys are the names of their columns, they must be identifiers different from the other columns.
+// The names point inside keys, split in place
+static bool front_matter_columns_parse (docbuilder_options *options, char *keys) {
+    static const char *reserved[] = {"url", "content", "options", "section_title", "rank", "documentation", "rowid", "id"};
+    for (char *key = strtok(keys, ","); key; key = strtok(NULL, ",")) {
+        size_t len = strlen(key);
+        bool valid = len > 0 && len <= FRONT_MATTER_KEY_MAX && !(key[0] >= '0' && key[0] <= '9') && strspn(key, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") == len;
+        for (size_t k = 0; valid && k < sizeof(reserved) / sizeof(reserved[0]); ++k) valid = strcasecmp(key, reserved[k]) != 0;
+        for (int k = 0; valid && k < options->nfm_columns; ++k) valid = strcasecmp(key, options->fm_columns[k]) != 0;
+        if (!valid) {
+            printf("Unsupported front matter column: %s (a name of at most %d letters, digits and _, not a column of the table).", key, FRONT_MATTER_KEY_MAX);
+            return false;
+        }
+        if (options->nfm_columns == FRONT_MATTER_COLUMNS) {
+            printf("Too many front matter columns, at most %d.", FRONT_MATTER_COLUMNS);
+            return false;
+        }
+        options->fm_columns[options->nfm_columns++] = key;
+    }
+    return true;
+}
+
+static bool fts_unindexed (const docbuilder_options *options, const char *column) {
+    size_t len = strlen(column);
+    for (const char *p = options->fts_unindexed; p && *p; p += strcspn(p, ",")) {
+        if (*p == ',') ++p;
+        size_t n = strcspn(p, ",");
+        if (n == len && strncmp(p, column, len) == 0) return true;
+    }
+    return false;
+}
+
+// a contentless index has no UNINDEXED columns, they are only stored in documentation_rows
+static bool fts_column_indexed (const docbuilder_options *options, const char *column) {
+    return options->fts_content != FTS_CONTENT_NONE || !fts_unindexed(options, column);
+}
+
+// weight of the column in the bm25 rank, 1 when --fts-weights doesn't have it
+static double fts_weight (const docbuilder_options *options, const char *column) {
+    size_t len = strlen(column);
+    for (const char *p = options->fts_weights; p && *p; p += strcspn(p, ",")) {
+        if (*p == ',') ++p;
+        size_t n = strcspn(p, ":,");
+        if (n == len && strncmp(p, column, len) == 0 && p[n] == ':') return strtod(p + n + 1, NULL);
+    }
+    return 1.0;
+}
+
+// the FTS5 options are written as they are in the statements, only the known values are accepted
+static bool fts_options_valid (const docbuilder_options *options) {
+    const char *columns[TABLE_COLUMNS_MAX];
+    int ncolumns = table_column_list(options, columns);
+    for (const char *p = options->fts_unindexed; p && *p; p += strcspn(p, ",")) {
+        if (*p == ',') ++p;
+        size_t n = strcspn(p, ",");
+        bool found = false;
+        for (int i = 0; i < ncolumns && !found; ++i) found = (strlen(columns[i]) == n && strncmp(p, columns[i], n) == 0);
+        if (!found) {
+            printf("Unknown column in --fts-unindexed: %.*s (the columns are %s).", (int)n, p, options->columns);
+            return false;
+        }
+    }
+    for (const char *p = options->fts_weights; p && *p; p += strcspn(p, ",")) {
+        if (*p == ',') ++p;
+        size_t n = strcspn(p, ":,");
+        bool found = false;
+        for (int i = 0; i < ncolumns && !found; ++i) found = (strlen(columns[i]) == n && strncmp(p, columns[i], n) == 0 && fts_column_indexed(options, columns[i]));
+        char *end = NULL;
+        double weight = (p[n] == ':') ? strtod(p + n + 1, &end) : -1;
+        if (!found || weight < 0 || weight > 1e6 || !end || end == p + n + 1 || (*end && *end != ',')) {
+            printf("Unsupported --fts-weights: %.*s (column:weight, the columns are %s).", (int)strcspn(p, ","), p, options->columns);
+            return false;
+        }
+    }
+    if (options->fts_content == FTS_CONTENT_NONE && fts_unindexed(options, "content")) {
+        printf("The content column of a contentless index can't be unindexed.");
+        return false;
+    }
+    // the url of an indexed page is changed when it is removed and another page has the same text
+    if (options->fts_content == FTS_CONTENT_NONE && options->dedup) {
+        printf("The contentless index doesn't support --dedup.");
+        return false;
+    }
+    if (options->fts_prefix && (!options->fts_prefix[0] || options->fts_prefix[strspn(options->fts_prefix, "0123456789,")])) {
+        printf("Unsupported FTS5 prefix: %s.", options->fts_prefix);
+        return false;
+    }
+    if (options->fts_detail && strcmp(options->fts_detail, "full") && strcmp(options->fts_detail, "column") && strcmp(options->fts_detail, "none")) {
+        printf("Unsupported FTS5 detail: %s.", options->fts_detail);
+        return false;
+    }
+    // the tokenizer is written inside the sql string literal, and inside the json string of the weblite request
+    if (options->fts_tokenizer && (!options->fts_tokenizer[0] || strpbrk(options->fts_tokenizer, "\"\\\n"))) {
+        printf("Unsupported FTS5 tokenizer: %s.", options->fts_tokenizer);
+        return false;
+    }
+    return true;
+}
+
+static void sql_append (scratch_buffer *sql, size_t *len, const char *format, ...) {
+    // most statements fit in the space already reserved, a longer one is formatted again
+    size_t size = 256;
+    for (;;) {
+        char *b = scratch_reserve(sql, *len + size);
+        va_list args;
+        va_start(args, format);
+        size_t n = (size_t)vsnprintf(b + *len, size, format, args);
+        va_end(args);
+        if (n < size) {
+            *len += n;
+            return;
+        }
+        size = n + 1;
+    }
+}
+
+// comma separated columns of a statement, each one with the given prefix (new., old.)
+static void sql_append_columns (scratch_buffer *sql, size_t *len, const char *prefix, const char **columns, int ncolumns) {
+    for (int i = 0; i < ncolumns; ++i) sql_append(sql, len, "%s%s%s", (i) ? ", " : "", prefix, columns[i]);
+}
+
+// comma separated list of the columns, written by the INSERT statements
+static char *table_columns (const docbuilder_options *options) {
+    const char *columns[TABLE_COLUMNS_MAX];
+    int ncolumns = table_column_list(options, columns);
+    scratch_buffer sql = {0};
+    size_t len = 0;
+    sql_append_columns(&sql, &len, "", columns, ncolumns);
+    return sql.data;
+}
+
+// statements that create the tables, one per line, the existing tables are dropped first when drop is true
+static const char *fts_schema (const docbuilder_options *options, bool drop, scratch_buffer *sql) {
+    const char *columns[TABLE_COLUMNS_MAX], *indexed[TABLE_COLUMNS_MAX], *stored[TABLE_COLUMNS_MAX];
+    int ncolumns = table_column_list(options, columns), nindexed = 0, nstored = 0;
+    fts_content layout = options->fts_content;
+    
+    // a contentless index has no UNINDEXED columns, they are only stored in documentation_rows
+    for (int i = 0; i < ncolumns; ++i) {
+        bool is_content = (strcmp(columns[i], "content") == 0);
+        if (fts_column_indexed(options, columns[i])) indexed[nindexed++] = columns[i];
+        if (layout == FTS_CONTENT_EXTERNAL || (layout == FTS_CONTENT_NONE && !is_content)) stored[nstored++] = columns[i];
+    }
+    
+    size_t len = 0;
+    scratch_reserve(sql, 1)[0] = 0;
+    if (drop) {
+        if (layout == FTS_CONTENT_NONE) sql_append(sql, &len, "DROP VIEW IF EXISTS documentation_input;\n");
+        sql_append(sql, &len, "DROP TABLE IF EXISTS documentation;\n");
+        if (layout != FTS_CONTENT_INTERNAL) sql_append(sql, &len, "DROP TABLE IF EXISTS documentation_rows;\n");
+        if (options->dedup) sql_append(sql, &len, "DROP TABLE IF EXISTS documentation_urls;\n");
+        if (options->autocomplete) sql_append(sql, &len, "DROP TABLE IF EXISTS documentation_autocomplete;\n");
+    }
+    
+    // the urls of the pages with the same text of the page indexed with the canonical url
+    if (options->dedup) {
+        sql_append(sql, &len, "CREATE TABLE IF NOT EXISTS documentation_urls (url TEXT PRIMARY KEY, canonical TEXT NOT NULL);\n");
+        sql_append(sql, &len, "CREATE INDEX IF NOT EXISTS documentation_urls_canonical ON documentation_urls (canonical);\n");
+    }
+    
+    // type-ahead: WHERE prefix1 = ?1 (or prefix2) ORDER BY score DESC LIMIT k reads the index in order,
+    // longer prefixes are a range of the key index, WHERE key >= ?1 AND key < ?1 || x'ff'. The indexes
+    // only hold the rowid, the unique (url, key) is used by INSERT OR REPLACE and by the DELETE of a page
+    if (options->autocomplete) {
+        sql_append(sql, &len, "CREATE TABLE IF NOT EXISTS documentation_autocomplete (id INTEGER PRIMARY KEY, key TEXT NOT NULL, url TEXT NOT NULL, term TEXT NOT NULL, score INTEGER NOT NULL, "
+                   "prefix1 TEXT GENERATED ALWAYS AS (substr(key, 1, 1)) VIRTUAL, prefix2 TEXT GENERATED ALWAYS AS (substr(key, 1, 2)) VIRTUAL, UNIQUE (url, key));\n");
+        sql_append(sql, &len, "CREATE INDEX IF NOT EXISTS documentation_autocomplete_key ON documentation_autocomplete (key);\n");
+        sql_append(sql, &len, "CREATE INDEX IF NOT EXISTS documentation_autocomplete_prefix1 ON documentation_autocomplete (prefix1, score DESC);\n");
+        sql_append(sql, &len, "CREATE INDEX IF NOT EXISTS documentation_autocomplete_prefix2 ON documentation_autocomplete (prefix2, score DESC);\n");
+    }
+    
+    // the url index is used by the DELETE of a changed page
+    if (layout != FTS_CONTENT_INTERNAL) {
+        sql_append(sql, &len, "CREATE TABLE IF NOT EXISTS documentation_rows (id INTEGER PRIMARY KEY, ");
+        sql_append_columns(sql, &len, "", stored, nstored);
+        sql_append(sql, &len, ");\n");
+        sql_append(sql, &len, "CREATE INDEX IF NOT EXISTS documentation_rows_url ON documentation_rows (url);\n");
+    }
+    
+    sql_append(sql, &len, "CREATE VIRTUAL TABLE IF NOT EXISTS documentation USING fts5 (");
+    for (int i = 0; i < nindexed; ++i) {
+        sql_append(sql, &len, "%s%s%s", (i) ? ", " : "", indexed[i], (fts_unindexed(options, indexed[i])) ? " UNINDEXED" : "");
+    }
+    if (options->fts_prefix) {
+        sql_append(sql, &len, ", prefix='");
+        for (const char *p = options->fts_prefix; *p; ++p) sql_append(sql, &len, "%c", (*p == ',') ? ' ' : *p);
+        sql_append(sql, &len, "'");
+    }
+    if (options->fts_detail) sql_append(sql, &len, ", detail=%s", options->fts_detail);
+    if (!options->fts_columnsize) sql_append(sql, &len, ", columnsize=0");
+    if (options->fts_tokenizer) {
+        // the tokenizer arguments are quoted inside the option string
+        sql_append(sql, &len, ", tokenize='");
+        for (const char *p = options->fts_tokenizer; *p; ++p) sql_append(sql, &len, "%s%c", (*p == '\'') ? "'" : "", *p);
+        sql_append(sql, &len, "'");
+    }
+    if (layout == FTS_CONTENT_EXTERNAL) sql_append(sql, &len, ", content='documentation_rows', content_rowid='id'");
+    if (layout == FTS_CONTENT_NONE) sql_append(sql, &len, ", content='', contentless_delete=1");
+    sql_append(sql, &len, ");\n");
+    
+    if (layout == FTS_CONTENT_EXTERNAL) {
+        // the 'delete' command needs the values indexed for the row
+        sql_append(sql, &len, "CREATE TRIGGER IF NOT EXISTS documentation_insert AFTER INSERT ON documentation_rows BEGIN INSERT INTO documentation (rowid, ");
+        sql_append_columns(sql, &len, "", indexed, nindexed);
+        sql_append(sql, &len, ") VALUES (new.id, ");
+        sql_append_columns(sql, &len, "new.", indexed, nindexed);
+        sql_append(sql, &len, "); END;\n");
+        sql_append(sql, &len, "CREATE TRIGGER IF NOT EXISTS documentation_delete AFTER DELETE ON documentation_rows BEGIN INSERT INTO documentation (documentation, rowid, ");
+        sql_append_columns(sql, &len, "", indexed, nindexed);
+        sql_append(sql, &len, ") VALUES ('delete', old.id, ");
+        sql_append_columns(sql, &len, "old.", indexed, nindexed);
+        sql_append(sql, &len, "); END;\n");
+        sql_append(sql, &len, "CREATE TRIGGER IF NOT EXISTS documentation_update AFTER UPDATE ON documentation_rows BEGIN INSERT INTO documentation (documentation, rowid, ");
+        sql_append_columns(sql, &len, "", indexed, nindexed);
+        sql_append(sql, &len, ") VALUES ('delete', old.id, ");
+        sql_append_columns(sql, &len, "old.", indexed, nindexed);
+        sql_append(sql, &len, "); INSERT INTO documentation (rowid, ");
+        sql_append_columns(sql, &len, "", indexed, nindexed);
+        sql_append(sql, &len, ") VALUES (new.id, ");
+        sql_append_columns(sql, &len, "new.", indexed, nindexed);
+        sql_append(sql, &len, "); END;\n");
+    } else if (layout == FTS_CONTENT_NONE) {
+        sql_append(sql, &len, "CREATE VIEW IF NOT EXISTS documentation_input AS SELECT id, ");
+        for (int i = 0; i < ncolumns; ++i) {
+            sql_append(sql, &len, "%s%s", (i) ? ", " : "", (strcmp(columns[i], "content") == 0) ? "NULL AS content" : columns[i]);
+        }
+        sql_append(sql, &len, " FROM documentation_rows;\n");
+        sql_append(sql, &len, "CREATE TRIGGER IF NOT EXISTS documentation_insert INSTEAD OF INSERT ON documentation_input BEGIN INSERT INTO documentation_rows (");
+        sql_append_columns(sql, &len, "", stored, nstored);
+        sql_append(sql, &len, ") VALUES (");
+        sql_append_columns(sql, &len, "new.", stored, nstored);
+        sql_append(sql, &len, "); INSERT INTO documentation (rowid, ");
+        sql_append_columns(sql, &len, "", indexed, nindexed);
+        sql_append(sql, &len, ") VALUES (last_insert_rowid(), ");
+        sql_append_columns(sql, &len, "new.", indexed, nindexed);
+        sql_append(sql, &len, "); END;\n");
+        sql_append(sql, &len, "CREATE TRIGGER IF NOT EXISTS documentation_delete INSTEAD OF DELETE ON documentation_input BEGIN DELETE FROM documentation WHERE rowid = old.id; DELETE FROM documentation_rows WHERE id = old.id; END;\n");
+    }
+    return sql->data;
+}
+
+// statements run once all the rows are written: the settings used by the later updates and the final merge
+static const char *fts_finish (const docbuilder_options *options, bool optimize, scratch_buffer *sql) {
+    size_t len = 0;
+    scratch_reserve(sql, 1)[0] = 0;
+    
+    // ORDER BY rank uses the weights of the columns, one for each column of the FTS5 table
+    if (options->fts_weights) {
+        const char *columns[TABLE_COLUMNS_MAX];
+        int ncolumns = table_column_list(options, columns), n = 0;
+        sql_append(sql, &len, "INSERT INTO documentation (documentation, rank) VALUES ('rank', 'bm25(");
+        for (int i = 0; i < ncolumns; ++i) {
+            if (fts_column_indexed(options, columns[i])) sql_append(sql, &len, "%s%g", (n++) ? ", " : "", fts_weight(options, columns[i]));
+        }
+        sql_append(sql, &len, ")');\n");
+    }
+    if (options->fts_pgsz >= 0) sql_append(sql, &len, "INSERT INTO documentation (documentation, rank) VALUES ('pgsz', %d);\n", options->fts_pgsz);
+    if (options->fts_automerge >= 0) sql_append(sql, &len, "INSERT INTO documentation (documentation, rank) VALUES ('automerge', %d);\n", options->fts_automerge);
+    if (options->fts_crisismerge >= 0) sql_append(sql, &len, "INSERT INTO documentation (documentation, rank) VALUES ('crisismerge', %d);\n", options->fts_crisismerge);
+    if (optimize) sql_append(sql, &len, "INSERT INTO documentation (documentation) VALUES ('optimize');\n");
+    return sql->data;
+}
+
+// MARK: - Uploader -
+
+// The statements are posted to the weblite sql endpoint while they are generated, so the corpus is
+// never sent as a single request. A request body ({"sql": "...", "database": "..."}) is cut at the first
+// page boundary after upload_bytes, and a page is never split between two requests. The schema goes
+// alone and must be acknowledged first. After that the requests of the pages can run in any order, so
+// up to upload_depth of them are pipelined on a single keep-alive connection. A request that fails, or
+// whose connection drops before its response, is sent again with an exponential backoff.
+
+#if ENABLE_UPLOAD
+static void upload_fail (uploader *up, const char *reason) {
+    printf("Upload to %s fails: %s.", up->host, reason);
+    exit(-13);
+}
+
+static void upload_batch_free (upload_batch *batch) {
+    scratch_free(&batch->sql);
+    doc_list_free(&batch->urls);
+    memset(batch, 0, sizeof(upload_batch));
+}
+
+static void upload_disconnect (uploader *up) {
+    if (up->ssl) SSL_free(up->ssl);
+    if (up->fd >= 0) close(up->fd);
+    up->ssl = NULL;
+    up->fd = -1;
+    up->rpos = up->rlen = 0;
+}
+
+static bool upload_connect (uploader *up) {
+    struct addrinfo hints = {0}, *res = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(up->host, up->port, &hints, &res) != 0) return false;
+    
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return false;
+    
+    // a large batch can take a while to be executed, but a server that stops answering is an error
+    int one = 1;
+    struct timeval timeout = {UPLOAD_TIMEOUT, 0};
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    up->fd = fd;
+    
+    if (up->tls) {
+        up->ssl = SSL_new(up->ctx);
+        if (!up->ssl || SSL_set_fd(up->ssl, fd) != 1 || SSL_set_tlsext_host_name(up->ssl, up->host) != 1 ||
+            SSL_set1_host(up->ssl, up->host) != 1 || SSL_connect(up->ssl) != 1) {
+            upload_disconnect(up);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool upload_send_bytes (uploader *up, const char *data, size_t len) {
+    while (len) {
+        size_t n = (len > INT32_MAX) ? INT32_MAX : len;
+        ssize_t nwrote = (up->ssl) ? SSL_write(up->ssl, data, (int)n) : send(up->fd, data, n, MSG_NOSIGNAL);
+        if (nwrote <= 0) {
+            if (!up->ssl && nwrote < 0 && errno == EINTR) continue;
+            return false;
+        }
+        data += nwrote;
+        len -= (size_t)nwrote;
+    }
+    return true;
+}
+
+static bool upload_fill (uploader *up) {
+    ssize_t nread;
+    do {
+        nread = (up->ssl) ? SSL_read(up->ssl, up->rbuf, sizeof(up->rbuf)) : recv(up->fd, up->rbuf, sizeof(up->rbuf), 0);
+    } while (!up->ssl && nread < 0 && errno == EINTR);
+    if (nread <= 0) return false;
+    up->rpos = 0;
+    up->rlen = (size_t)nread;
+    return true;
+}
+
+// reads a header line without its CRLF, the longer lines are truncated
+static bool upload_read_line (uploader *up, char *line, size_t size) {
+    size_t len = 0;
+    while (true) {
+        if (up->rpos == up->rlen && !upload_fill(up)) return false;
+        char c = up->rbuf[up->rpos++];
+        if (c == '\n') break;
+        if (len + 1 < size) line[len++] = c;
+    }
+    if (len && line[len-1] == '\r') --len;
+    line[len] = 0;
+    return true;
+}
+
+// reads len bytes of the response body (len SIZE_MAX reads until the connection is closed), only the
+// first UPLOAD_MAX_RESPONSE bytes are kept to report an error
+static bool upload_read_body (uploader *up, size_t len) {
+    while (len) {
+        if (up->rpos == up->rlen && !upload_fill(up)) return (len == SIZE_MAX);
+        size_t n = up->rlen - up->rpos;
+        if (n > len) n = len;
+        size_t keep = (up->response_len < UPLOAD_MAX_RESPONSE) ? UPLOAD_MAX_RESPONSE - up->response_len : 0;
+        if (keep > n) keep = n;
+        memcpy(scratch_reserve(&up->response, up->response_len + keep + 1) + up->response_len, up->rbuf + up->rpos, keep);
+        up->response_len += keep;
+        up->rpos += n;
+        if (len != SIZE_MAX) len -= n;
+    }
+    return true;
+}
+
+// reads the response of the oldest request in flight, returns its status code or -1 if the connection was lost
+static int upload_read_response (uploader *up, bool *closed) {
+    char line[1024];
+    int status = 0;
+    size_t length = SIZE_MAX;
+    bool chunked = false;
+    
+    *closed = false;
+    up->response_len = 0;
+    if (up->fd < 0 || !upload_read_line(up, line, sizeof(line))) return -1;
+    if (sscanf(line, "HTTP/%*s %d", &status) != 1) return -1;
+    
+    while (true) {
+        if (!upload_read_line(up, line, sizeof(line))) return -1;
+        if (line[0] == 0) break;
+        if (strncasecmp(line, "content-length:", 15) == 0) length = strtoull(line + 15, NULL, 10);
+        else if (strncasecmp(line, "transfer-encoding:", 18) == 0 && strstr(line + 18, "chunked")) chunked = true;
+        else if (strncasecmp(line, "connection:", 11) == 0 && strstr(line + 11, "close")) *closed = true;
+    }
+    
+    if (chunked) {
+        while (true) {
+            if (!upload_read_line(up, line, sizeof(line))) return -1;
+            size_t size = strtoull(line, NULL, 16);
+            if (size == 0) break;
+            if (!upload_read_body(up, size) || !upload_read_line(up, line, sizeof(line))) return -1;
+        }
+        // trailer
+        do {
+            if (!upload_read_line(up, line, sizeof(line))) return -1;
+        } while (line[0]);
+    } else {
+        if (length == SIZE_MAX) *closed = true;
+        if (!upload_read_body(up, length)) return -1;
+    }
+    scratch_reserve(&up->response, up->response_len + 1)[up->response_len] = 0;
+    return status;
+}
+
+static bool upload_send (uploader *up, upload_batch *batch) {
+    // the sql is a json string, its newlines are escaped like the ones of write_line
+    size_t body_len = 0;
+    sql_append(&up->body, &body_len, "{\"sql\": \"%s", (up->use_transaction) ? "BEGIN TRANSACTION;\\n" : "");
+    
+    // a batch sent again first deletes the rows it may have inserted the previous time
+    if (batch->attempts > 0) {
+        sql_append(&up->body, &body_len, "DELETE FROM %s WHERE url IN (", up->table);
+        for (size_t i = 0; i < batch->urls.count; ++i) {
+            sql_append(&up->body, &body_len, "%s'%s'", (i) ? ", " : "", escape_string(batch->urls.paths[i], true, true, &up->escaped));
+        }
+        sql_append(&up->body, &body_len, ")");
+        for (size_t i = 0; up->split_sections && i < batch->urls.count; ++i) {
+            const char *url = escape_string(batch->urls.paths[i], true, true, &up->escaped);
+            sql_append(&up->body, &body_len, " OR (url >= '%s#' AND url < '%s$')", url, url);
+        }
+        sql_append(&up->body, &body_len, ";\\n");
+        if (up->dedup) {
+            sql_append(&up->body, &body_len, "DELETE FROM documentation_urls WHERE url IN (");
+            for (size_t i = 0; i < batch->urls.count; ++i) {
+                sql_append(&up->body, &body_len, "%s'%s'", (i) ? ", " : "", escape_string(batch->urls.paths[i], true, true, &up->escaped));
+            }
+            sql_append(&up->body, &body_len, ");\\n");
+        }
+    }
+    const char *body = up->body.data;
+    const char *tail = up->tail.data;
+    size_t tail_len = up->tail_len;
+    
+    // a compressed body is built again at each attempt, the cleanup statements change it
+    size_t compressed_len = 0;
+    if (up->compress) {
+        compressor_write(up->compress, body, body_len, false, &up->compressed, &compressed_len);
+        compressor_write(up->compress, batch->sql.data, batch->sql_len, false, &up->compressed, &compressed_len);
+        compressor_write(up->compress, tail, tail_len, true, &up->compressed, &compressed_len);
+    }
+    
+    size_t size = strlen(up->host) + strlen(up->path) + strlen(up->token) + 512;
+    char *head = scratch_reserve(&up->head, size);
+    size_t head_len = snprintf(head, size, "POST %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: docbuilder/%s\r\n"
+                               "Authorization: Bearer %s\r\nContent-Type: application/json\r\nAccept: application/json\r\n",
+                               up->path, up->host, DOCBUILDER_VERSION, up->token);
+    if (up->compress) head_len += snprintf(head + head_len, size - head_len, "Content-Encoding: %s\r\n", compress_name(up->compress->format));
+    head_len += snprintf(head + head_len, size - head_len, "Content-Length: %zu\r\nConnection: keep-alive\r\n\r\n",
+                         (up->compress) ? compressed_len : body_len + batch->sql_len + tail_len);
+    
+    if (up->compress) return (upload_send_bytes(up, head, head_len) && upload_send_bytes(up, up->compressed.data, compressed_len));
+    return (upload_send_bytes(up, head, head_len) && upload_send_bytes(up, body, body_len) &&
+            upload_send_bytes(up, batch->sql.data, batch->sql_len) && upload_send_bytes(up, tail, tail_len));
+}
+
+static void upload_backoff (int attempt) {
+    // UPLOAD_BACKOFF ms doubled at each attempt
+    long delay = (long)UPLOAD_BACKOFF << ((attempt < 6) ? attempt - 1 : 5);
+    struct timespec ts = {delay / 1000, (delay % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+// the connection has been lost (or closed by the server), every request in flight is sent again on a new one
+static void upload_reconnect (uploader *up) {
+    while (true) {
+        upload_disconnect(up);
+        if (up->failures > 0) upload_backoff(up->failures);
+        if (++up->failures > UPLOAD_MAX_ATTEMPTS) upload_fail(up, "unable to connect");
+        if (!upload_connect(up)) continue;
+        
+        bool sent = true;
+        for (int i = 0; i < up->queue_count && sent; ++i) {
+            if (++up->queue[i].attempts > UPLOAD_MAX_ATTEMPTS) upload_fail(up, "too many attempts");
+            ++up->nretries;
+            sent = upload_send(up, &up->queue[i]);
+        }
+        if (sent) return;
+    }
+}
+
+// waits for the response of the oldest request in flight
+static void upload_receive (uploader *up) {
+    bool closed = false;
+    int status = upload_read_response(up, &closed);
+    while (status < 0) {
+        upload_reconnect(up);
+        status = upload_read_response(up, &closed);
+    }
+    up->failures = 0;
+    
+    upload_batch batch = up->queue[0];
+    memmove(up->queue, up->queue + 1, (up->queue_count - 1) * sizeof(upload_batch));
+    --up->queue_count;
+    
+    bool retry = (status == 408 || status == 429 || status >= 500);
+    if (status >= 200 && status < 300 && !strstr(up->response.data, "error")) {
+        up->ready = true;
+        upload_batch_free(&batch);
+    } else if (retry && batch.attempts < UPLOAD_MAX_ATTEMPTS) {
+        // sent again after the other requests in flight
+        upload_backoff(++batch.attempts);
+        ++up->nretries;
+        up->queue[up->queue_count++] = batch;
+        if (!closed && !upload_send(up, &up->queue[up->queue_count - 1])) closed = true;
+    } else {
+        printf("Upload to %s fails with status %d: %s\n", up->host, status, up->response.data);
+        exit(-13);
+    }
+    
+    // the requests sent after a response that closes the connection are not executed
+    if (closed) {
+        upload_disconnect(up);
+        if (up->queue_count) upload_reconnect(up);
+    }
+}
+
+// sends the current batch, until the schema has been acknowledged a single request can be in flight
+static void upload_submit (uploader *up) {
+    if (up->current.sql_len == 0) return;
+    while (up->queue_count >= ((up->ready) ? up->depth : 1)) upload_receive(up);
+    
+    up->queue[up->queue_count++] = up->current;
+    memset(&up->current, 0, sizeof(upload_batch));
+    ++up->nrequests;
+    
+    if ((up->fd < 0 && !upload_connect(up)) || !upload_send(up, &up->queue[up->queue_count - 1])) upload_reconnect(up);
+}
+
+static void upload_write (uploader *up, const char *buffer, size_t len) {
+    upload_batch *batch = &up->current;
+    char *sql = scratch_reserve(&batch->sql, batch->sql_len + len + 1);
+    memcpy(sql + batch->sql_len, buffer, len);
+    batch->sql_len += len;
+}
+
+static void upload_add_url (uploader *up, const char *url) {
+    char *copy = strdup(url);
+    if (!copy) exit(-11);
+    doc_list_add(&up->current.urls, copy);
+}
+
+static uploader *upload_create (const docbuilder_options *options) {
+    uploader *up = (uploader *)calloc(1, sizeof(uploader));
+    const char *url = options->upload_url;
+    size_t len = strlen(url);
+    char *buffer = (up) ? (char *)malloc(len * 2 + 16) : NULL;
+    up->queue = (up) ? (upload_batch *)calloc(options->upload_depth, sizeof(upload_batch)) : NULL;
+    if (!up || !buffer || !up->queue) {
+        printf("Not enough memory to allocate the uploader.");
+        exit(-3);
+    }
+    // a dropped connection is reported by send/SSL_write, not by a signal
+    signal(SIGPIPE, SIG_IGN);
+    up->fd = -1;
+    up->token = getenv(UPLOAD_TOKEN_ENV);
+    if (!up->token) up->token = "";
+    up->use_transaction = options->use_transaction;
+    up->split_sections = options->split_sections;
+    up->table = fts_target(options);
+    up->dedup = options->dedup;
+    up->batch_bytes = options->upload_bytes;
+    up->depth = options->upload_depth;
+    up->compress = compressor_create(options->compress, options->compress_level);
+    
+    // the end of every body names the database, escaped like any other JSON string
+    sql_append(&up->tail, &up->tail_len, "%s\", \"database\": \"%s\"}", (up->use_transaction) ? "COMMIT;\\n" : "",
+               escape_string(options->database, false, true, &up->escaped));
+    
+    // http[s]://host[:port][/path], host, port and path are copied in buffer
+    const char *p = url;
+    if (strncmp(p, "https://", 8) == 0) {up->tls = true; p += 8;}
+    else if (strncmp(p, "http://", 7) == 0) p += 7;
+    else {
+        printf("Unsupported upload url %s.", url);
+        exit(-1);
+    }
+    const char *path = strchr(p, '/');
+    if (!path) path = p + strlen(p);
+    const char *colon = memchr(p, ':', path - p);
+    const char *host_end = (colon) ? colon : path;
+    
+    up->host = buffer;
+    memcpy(up->host, p, host_end - p);
+    up->host[host_end - p] = 0;
+    up->port = up->host + (host_end - p) + 1;
+    if (colon) {
+        memcpy(up->port, colon + 1, path - colon - 1);
+        up->port[path - colon - 1] = 0;
+    } else {
+        strcpy(up->port, (up->tls) ? "443" : "80");
+    }
+    up->path = up->port + strlen(up->port) + 1;
+    strcpy(up->path, (*path) ? path : "/");
+    
+    if (up->tls) {
+        up->ctx = SSL_CTX_new(TLS_client_method());
+        if (!up->ctx || SSL_CTX_set_default_verify_paths(up->ctx) != 1) upload_fail(up, "unable to initialize TLS");
+        SSL_CTX_set_verify(up->ctx, SSL_VERIFY_PEER, NULL);
+    }
+    return up;
+}
+
+// sends the last batch and waits for every response
+static void upload_finish (uploader *up) {
+    upload_submit(up);
+    while (up->queue_count) upload_receive(up);
+    upload_disconnect(up);
+    printf("Uploaded %zu requests to %s (%zu retries).\n", up->nrequests, up->host, up->nretries);
+    
+    upload_batch_free(&up->current);
+    scratch_free(&up->head);
+    scratch_free(&up->body);
+    scratch_free(&up->tail);
+    scratch_free(&up->escaped);
+    scratch_free(&up->response);
+    scratch_free(&up->compressed);
+    compressor_free(up->compress);
+    if (up->ctx) SSL_CTX_free(up->ctx);
+    free(up->queue);
+    free(up->host);
+    free(up);
+}
+#endif
+
+// MARK: - Autocomplete -
+
+// With --autocomplete the title of each page (front matter) and its #, ## and ### headings are written
+// to documentation_autocomplete, one row for each of the first AUTOCOMPLETE_WORDS words of the term, so
+// "inst" finds "How to install". The key is the normalized term from that word, the score orders the
+// rows of a prefix: titles before headings, the first word before the next ones, the pages closer to
+// the root first. The score of a row doesn't depend on the other pages, an incremental build only
+// replaces the rows of the changed pages.
+
+// lower case letters (ascii and latin-1) and digits, apostrophes are dropped and any other ascii run is
+// a single space, the other utf-8 characters are kept as they are
+static size_t autocomplete_normalize (const char *term, size_t len, char *key) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)term[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+            // U+00C0 to U+00DE are 0xC3 0x80-0x9E, lower case is 0x20 after them (but U+00D7 is ×)
+            if (n && (unsigned char)key[n-1] == 0xC3 && c >= 0x80 && c <= 0x9E && c != 0x97) c += 0x20;
+            key[n++] = (char)c;
+        } else if (c != '\'' && n && key[n-1] != ' ') key[n++] = ' ';
+    }
+    if (n && key[n-1] == ' ') --n;
+    return n;
+}
+
+// kind is 0 for the page title, the level of a heading otherwise
+static int autocomplete_score (const docbuilder_options *options, const char *url, int kind, int word) {
+    const char *base_url = (options->base_url) ? options->base_url : "";
+    size_t base_len = strlen(base_url);
+    const char *path = (strncmp(url, base_url, base_len) == 0) ? url + base_len : url;
+    int depth = 0;
+    for (const char *p = path; *p && *p != '#'; ++p) depth += (*p == '/');
+    return (4 - kind) * 1000 - word * 100 - ((depth < 99) ? depth : 99);
+}
+
+// MARK: - Output Writer -
+
+// The statements are copied in a block of OUTPUT_BLOCK_SIZE bytes, when it is full it is handed to the
+// writer thread and the other block is filled, so the next pages are parsed while the previous ones
+// are written. The thread keeps the first write error and stops writing, the main thread reports it
+// when it hands over the next block or closes the file. The file is synced only once, when closed.
+
+// returns the errno of the failed write, 0 when the whole data has been written
+static int output_writer_write (output_writer *w, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t nwrote = write(w->fd, data, len);
+        if (nwrote < 0 && errno == EINTR) continue;
+        if (nwrote <= 0) return (nwrote < 0) ? errno : EIO;
+        data += nwrote;
+        len -= (size_t)nwrote;
+    }
+    return 0;
+}
+
+static void *output_writer_run (void *arg) {
+    output_writer *w = (output_writer *)arg;
+    
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (!w->pending && !w->closing) pthread_cond_wait(&w->cond, &w->lock);
+        const char *data = w->pending;
+        size_t len = (data) ? w->pending_len : 0;
+        int error = w->error;
+        pthread_mutex_unlock(&w->lock);
+        
+        // the end of the compressed stream is written once every block has been compressed
+        if (w->compress && !error) {
+            size_t out_len = 0;
+            compressor_write(w->compress, data, len, (data == NULL), &w->compressed, &out_len);
+            data = w->compressed.data;
+            len = out_len;
+        }
+        if (!error && data) error = output_writer_write(w, data, len);
+        
+        pthread_mutex_lock(&w->lock);
+        w->error = error;
+        if (!w->pending) break;
+        w->pending = NULL;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// the output is incomplete, it is removed so that it can't be loaded by mistake
+static void output_writer_fail (output_writer *w, int error) {
+    printf("Write to %s fails: %s.", w->path, strerror(error));
+    file_delete(w->path);
+    exit(-6);
+}
+
+static output_writer *output_writer_open (const docbuilder_options *options, const char *path) {
+    output_writer *w = (output_writer *)calloc(1, sizeof(output_writer));
+    if (!w) {
+        printf("Not enough memory to allocate %zu bytes.", sizeof(output_writer));
+        exit(-3);
+    }
+    
+    w->path = path;
+    w->compress = compressor_create(options->compress, options->compress_level);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (w->fd < 0) {
+        printf("Unable to create sql file :%s.", path);
+        exit(-2);
+    }
+    
+    w->blocks[0] = (char *)malloc(OUTPUT_BLOCK_SIZE);
+    w->blocks[1] = (char *)malloc(OUTPUT_BLOCK_SIZE);
+    if (!w->blocks[0] || !w->blocks[1]) {
+        printf("Not enough memory to allocate %d bytes.", OUTPUT_BLOCK_SIZE);
+        exit(-3);
+    }
+    
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, output_writer_run, w) != 0) {
+        printf("Unable to create writer thread.");
+        exit(-12);
+    }
+    return w;
+}
+
+// hands the current block to the thread as soon as it has written the previous one
+static void output_writer_flush (output_writer *w) {
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) pthread_cond_wait(&w->cond, &w->lock);
+    int error = w->error;
+    if (!error && w->len) {
+        w->pending = w->blocks[w->current];
+        w->pending_len = w->len;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    
+    if (error) output_writer_fail(w, error);
+    w->current ^= 1;
+    w->len = 0;
+}
+
+static void output_writer_append (output_writer *w, const char *data, size_t len) {
+    while (len) {
+        size_t n = OUTPUT_BLOCK_SIZE - w->len;
+        if (n > len) n = len;
+        memcpy(w->blocks[w->current] + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+        if (w->len == OUTPUT_BLOCK_SIZE) output_writer_flush(w);
+    }
+}
+
+static void output_writer_close (output_writer *w) {
+    output_writer_flush(w);
+    
+    pthread_mutex_lock(&w->lock);
+    while (w->pending) pthread_cond_wait(&w->cond, &w->lock);
+    w->closing = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    
+    // file systems that can't sync the file are not an error
+    int error = w->error;
+    if (!error && fsync(w->fd) != 0 && errno != EINVAL && errno != ENOTSUP) error = errno;
+    if (close(w->fd) != 0 && !error) error = errno;
+    if (error) output_writer_fail(w, error);
+    
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    compressor_free(w->compress);
+    scratch_free(&w->compressed);
+    free(w->blocks[0]);
+    free(w->blocks[1]);
+    free(w);
+}
+
+// MARK: -
+
+// separator of the statements, escaped when they are a json string (the file and the upload stream alike)
+static const char *output_newline (const docbuilder_output *output) {
+    return (output->json_strict) ? "\\n" : "\n";
+}
+
+static void write_line (docbuilder_output *output, const char *buffer, size_t blen, int add_newline) {
+    if (blen == -1) blen = strlen(buffer);
+    const char *newline = output_newline(output);
+    
+    output_writer_append(output->writer, buffer, blen);
+    if (add_newline) output_writer_append(output->writer, newline, strlen(newline));
+    
+    #if ENABLE_UPLOAD
+    if (output->upload) {
+        upload_write(output->upload, buffer, blen);
+        if (add_newline) upload_write(output->upload, newline, strlen(newline));
+    }
+    #endif
+}
+
+// BEGIN/COMMIT of the whole sql file, each uploaded request has its own transaction (see upload_send)
+static void write_transaction_line (docbuilder_output *output, const char *line) {
+    const char *newline = output_newline(output);
+    output_writer_append(output->writer, line, strlen(line));
+    output_writer_append(output->writer, newline, strlen(newline));
+}
+
+// statements separated by newlines, written one per line
+static void write_schema (docbuilder_output *output, const char *sql) {
+    for (const char *line = sql; *line; ) {
+        const char *end = strchr(line, '\n');
+        write_line(output, line, end - line, 1);
+        line = end + 1;
+    }
+}
+
+// the url as written inside the statements, escaped like the text of the page
+static const char *output_url (const docbuilder_options *options, docbuilder_output *output, const char *url) {
+    return escape_string(url, options->sql_escape, options->json_escape, &output->escaped);
+}
+
+// closes the multi-row INSERT statement still open, it must be called before writing any other statement
+static void end_file_batch (docbuilder_output *output) {
+    if (output->batch_count == 0) return;
+    write_line(output, ";", 1, 1);
+    output->batch_count = 0;
+    output->batch_size = 0;
+}
+
+// called after the statements of each page, the uploaded request is sent once it is large enough
+// the autocomplete rows are written in their own statements, so they don't close the batches of the pages
+static void autocomplete_flush (docbuilder_output *output) {
+    if (output->autocomplete_rows == 0) return;
+    end_file_batch(output);
+    write_line(output, "INSERT OR REPLACE INTO documentation_autocomplete (key, url, term, score) VALUES ", -1, 0);
+    write_line(output, output->autocomplete.data, output->autocomplete_len, 0);
+    write_line(output, ";", 1, 1);
+    output->autocomplete_len = 0;
+    output->autocomplete_rows = 0;
+}
+
+static void upload_page_done (docbuilder_output *output) {
+    #if ENABLE_UPLOAD
+    uploader *up = output->upload;
+    if (!up || up->current.sql_len + output->autocomplete_len < up->batch_bytes) return;
+    autocomplete_flush(output);
+    end_file_batch(output);
+    upload_submit(up);
+    #else
+    (void)output;
+    #endif
+}
+
+#if ENABLE_SQLITE_OUTPUT
+static void database_exec (docbuilder_output *output, const char *sql) {
+    if (sqlite3_exec(output->db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        printf("Unable to execute %s (%s).", sql, sqlite3_errmsg(output->db));
+        exit(-10);
+    }
+}
+
+static void create_database (const docbuilder_options *options, docbuilder_output *output, const char *path) {
+    // in incremental mode the existing database is updated in place
+    if (!output->previous) file_delete(path);
+    
+    int rc = sqlite3_open(path, &output->db);
+    if (rc != SQLITE_OK) {
+        printf("Unable to create sqlite database %s.", (output->db) ? sqlite3_errmsg(output->db) : "");
+        exit(-2);
+    }
+    
+    // a failed build is simply run again, the journal is kept only when an existing database is updated
+    if (!output->previous) database_exec(output, "PRAGMA journal_mode=OFF;");
+    database_exec(output, "PRAGMA synchronous=OFF;");
+    database_exec(output, "PRAGMA locking_mode=EXCLUSIVE;");
+    database_exec(output, "PRAGMA temp_store=MEMORY;");
+    database_exec(output, "PRAGMA cache_size=-65536;");
+    
+    database_exec(output, fts_schema(options, false, &output->statement));
+    
+    // the options are already compact json (process_front_matter), they are stored as they are
+    const char *values = (OPTIONS_COL(options)) ? "?1, ?2, ?3" : "?1, ?2";
+    char sql[512];
+    char fields[FRONT_MATTER_COLUMNS * 6] = "";
+    for (int k = 0; k < options->nfm_columns; ++k) snprintf(fields + strlen(fields), sizeof(fields) - strlen(fields), ", ?%d", 5 + k);
+    snprintf(sql, sizeof(sql), "INSERT INTO %s (%s) VALUES (%s%s%s);", fts_target(options), options->columns, values, (options->split_sections) ? ", ?4" : "", fields);
+    rc = sqlite3_prepare_v3(output->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &output->insert_vm, NULL);
+    
+    // the rows of the sections of a page have the url of the page followed by #anchor
+    if (options->split_sections) snprintf(sql, sizeof(sql), "DELETE FROM %s WHERE url = ?1 OR (url >= ?1 || '#' AND url < ?1 || '$');", fts_target(options));
+    else snprintf(sql, sizeof(sql), "DELETE FROM %s WHERE url = ?1;", fts_target(options));
+    if (rc == SQLITE_OK) rc = sqlite3_prepare_v3(output->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &output->delete_vm, NULL);
+    if (rc == SQLITE_OK && options->autocomplete) {
+        rc = sqlite3_prepare_v3(output->db, "INSERT OR REPLACE INTO documentation_autocomplete (key, url, term, score) VALUES (?1, ?2, ?3, ?4);", -1, SQLITE_PREPARE_PERSISTENT, &output->autocomplete_vm, NULL);
+    }
+    if (rc != SQLITE_OK) {
+        printf("Unable to prepare documentation statements (%s).", sqlite3_errmsg(output->db));
+        exit(-3);
+    }
+    
+    database_exec(output, "BEGIN;");
+}
+
+static void close_database (const docbuilder_options *options, docbuilder_output *output) {
+    database_exec(output, "COMMIT;");
+    sqlite3_finalize(output->insert_vm);
+    sqlite3_finalize(output->delete_vm);
+    sqlite3_finalize(output->autocomplete_vm);
+    
+    // merge all the b-tree segments of the index into one, the shipped database is never written again
+    database_exec(output, fts_finish(options, true, &output->statement));
+    database_exec(output, "PRAGMA journal_mode=DELETE;");
+    
+    if (sqlite3_close(output->db) != SQLITE_OK) {
+        printf("Unable to close sqlite database (%s).", sqlite3_errmsg(output->db));
+        exit(-6);
+    }
+    output->db = NULL;
+}
+
+// every SQLITE_BATCH_ROWS changes the transaction is committed so the pending FTS5 data stays bounded
+static void database_step (docbuilder_output *output, sqlite3_stmt *vm) {
+    int rc = sqlite3_step(vm);
+    sqlite3_reset(vm);
+    sqlite3_clear_bindings(vm);
+    if (rc != SQLITE_DONE) {
+        printf("add_database error: %s\n", sqlite3_errmsg(output->db));
+        exit(-10);
+    }
+    
+    if (++output->batch_rows == SQLITE_BATCH_ROWS) {
+        database_exec(output, "COMMIT;");
+        database_exec(output, "BEGIN;");
+        output->batch_rows = 0;
+    }
+}
+
+static void add_database_entry(const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry, const char *url, const char *buffer, size_t size, const char *title, size_t title_len) {
+    sqlite3_stmt *vm = output->insert_vm;
+    
+    int rc = sqlite3_bind_text(vm, 1, url, -1, SQLITE_STATIC);
+    if (rc == SQLITE_OK) rc = sqlite3_bind_text(vm, 2, buffer, (int)size, SQLITE_STATIC);
+    if (rc == SQLITE_OK && OPTIONS_COL(options)) rc = sqlite3_bind_text(vm, 3, entry->astro_header, (int)entry->header_size, SQLITE_STATIC);
+    if (rc == SQLITE_OK && options->split_sections) rc = sqlite3_bind_text(vm, 4, title, (int)title_len, SQLITE_STATIC);
+    
+    // the front matter columns are ?5... (a missing key stays NULL)
+    for (int k = 0; rc == SQLITE_OK && k < options->nfm_columns; ++k) {
+        if (entry->field_len[k] != FIELD_NULL) rc = sqlite3_bind_text(vm, 5 + k, entry->fields + entry->field_start[k], (int)entry->field_len[k], SQLITE_STATIC);
+    }
+    if (rc != SQLITE_OK) {
+        printf("add_database error: %s\n", sqlite3_errmsg(output->db));
+        exit(-10);
+    }
+    
+    database_step(output, vm);
+}
+#endif
+
+static void create_file (const docbuilder_options *options, docbuilder_output *output, const char *path) {
+    file_delete(path);
+    output->writer = output_writer_open(options, path);
+    
+    // the statements are the sql string of the request body, closed in close_output
+    output->json_strict = options->json_strict;
+    if (options->format == FORMAT_WEBLITE_JSON) output_writer_append(output->writer, "{\"sql\": \"", 9);
+    
+    if (options->create_db) {
+        write_line(output, "CREATE DATABASE documentation.sqlite IF NOT EXISTS;", -1, 1);
+    }
+    
+    if (options->use_database) {
+        write_line(output, "USE DATABASE documentation.sqlite;", -1, 1);
+    }
+    
+    if (options->use_transaction) {
+        write_transaction_line(output, "BEGIN TRANSACTION;");
+    }
+    
+    // in incremental mode the table already contains the unchanged pages
+    write_schema(output, fts_schema(options, !output->previous, &output->statement));
+}
+
+static void create_output (const docbuilder_options *options, docbuilder_output *output, const char *path) {
+    if (options->dedup && output->previous) dedup_seed(&output->dedup, output->previous);
+#if ENABLE_UPLOAD
+    if (options->upload_url) output->upload = upload_create(options);
+#endif
+#if ENABLE_SQLITE_OUTPUT
+    if (options->format == FORMAT_SQLITE) create_database(options, output, path);
+    else create_file(options, output, path);
+#else
+    create_file(options, output, path);
+#endif
+#if ENABLE_UPLOAD
+    // the schema is the first request, sent alone
+    if (output->upload) upload_submit(output->upload);
+#endif
+    manifest_create(options, output, path);
+}
+
+static void close_output (const docbuilder_options *options, docbuilder_output *output) {
+    stats_time t = stats_now(options);
+#if ENABLE_SQLITE_OUTPUT
+    if (output->db) close_database(options, output);
+#endif
+    if (output->writer) {
+        autocomplete_flush(output);
+        end_file_batch(output);
+        write_schema(output, fts_finish(options, options->fts_optimize, &output->statement));
+    }
+    stats_lap(options, &output->stats.finish, &t);
+    #if ENABLE_UPLOAD
+    if (output->upload) upload_finish(output->upload);
+    output->upload = NULL;
+    stats_lap(options, &output->stats.upload, &t);
+    #endif
+    if (output->writer && options->use_transaction) {
+        write_transaction_line(output, "COMMIT;");
+    }
+    if (output->writer && options->format == FORMAT_WEBLITE_JSON) {
+        const char *database = escape_string(options->database, false, true, &output->escaped);
+        output_writer_append(output->writer, "\", \"database\": \"", 16);
+        output_writer_append(output->writer, database, strlen(database));
+        output_writer_append(output->writer, "\"}\n", 3);
+    }
+    if (output->writer) output_writer_close(output->writer);
+    output->writer = NULL;
+    manifest_close(output);
+    stats_lap(options, &output->stats.finish, &t);
+    manifest_free(output->previous);
+    output->previous = NULL;
+    doc_list_free(&output->urls);
+    scratch_free(&output->statement);
+    scratch_free(&output->escaped);
+    scratch_free(&output->section_url);
+    scratch_free(&output->section_title);
+    scratch_free(&output->autocomplete);
+    file_scratch_free(&output->scratch);
+    file_scratch_free(&output->dedup_scratch);
+    dedup_free(&output->dedup);
+}
+
+// bytes of the values of the front matter columns, written one after the other
+static size_t fields_length (const doc_entry *entry) {
+    size_t size = 0;
+    for (int k = 0; k < FRONT_MATTER_COLUMNS; ++k) {
+        if (entry->field_len[k] != FIELD_NULL && entry->field_start[k] + entry->field_len[k] > size) size = entry->field_start[k] + entry->field_len[k];
+    }
+    return size;
+}
+
+// the front matter columns of a row, NULL when the page doesn't have the key, returns the bytes written
+static size_t write_fields (const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry) {
+    size_t nwrote = 0;
+    for (int k = 0; k < options->nfm_columns; ++k) {
+        if (entry->field_len[k] == FIELD_NULL) {
+            write_line(output, ", NULL", 6, 0);
+            nwrote += 6;
+            continue;
+        }
+        write_line(output, ", '", 3, 0);
+        write_line(output, entry->fields + entry->field_start[k], entry->field_len[k], 0);
+        write_line(output, "'", 1, 0);
+        nwrote += entry->field_len[k] + 4;
+    }
+    return nwrote;
+}
+
+static void add_file_entry(const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry, const char *url, const char *buffer, size_t bsize, const char *title, size_t title_len) {
+    const char *astro_header = entry->astro_header;
+    size_t header_size = entry->header_size;
+    
+    url = output_url(options, output, url);
+    size_t url_size = strlen(url);
+    if (options->split_sections) {
+        title = escape_text(options, title, title_len, &output->section_title);
+        title_len = strlen(title);
+    }
+    
+    size_t blen;
+    if(OPTIONS_COL(options)){
+        blen = url_size + bsize + header_size + title_len + 1024;
+    } else {
+        blen = url_size + bsize + title_len + 1024;
+    }
+    if (options->nfm_columns) blen += fields_length(entry) + (size_t)options->nfm_columns * 6;
+    
+    // pages are grouped in the VALUES of the same statement, a page larger than batch_bytes is written alone
+    if (output->batch_count && output->batch_size + blen > options->batch_bytes) end_file_batch(output);
+    if (output->batch_count) {
+        write_line(output, ",", 1, 1);
+    } else {
+        // the columns can be longer than a fixed buffer with --fts-front-matter
+        write_line(output, "INSERT INTO ", 12, 0);
+        write_line(output, fts_target(options), -1, 0);
+        write_line(output, " (", 2, 0);
+        write_line(output, options->columns, -1, 0);
+        write_line(output, ") VALUES ", 9, 0);
+    }
+    
+    // the row is written piece by piece, the text of a section is a part of the page (not NUL terminated)
+    write_line(output, "('", 2, 0);
+    write_line(output, url, url_size, 0);
+    write_line(output, "', '", 4, 0);
+    write_line(output, buffer, bsize, 0);
+    if (OPTIONS_COL(options)) {
+        write_line(output, "', '", 4, 0);
+        write_line(output, astro_header, header_size, 0);
+        write_line(output, "'", 1, 0);
+    } else {
+        write_line(output, "'", 1, 0);
+    }
+    if (options->split_sections) {
+        write_line(output, ", '", 3, 0);
+        write_line(output, title, title_len, 0);
+        write_line(output, "'", 1, 0);
+    }
+    size_t nwrote = write_fields(options, output, entry);
+    write_line(output, ")", 1, 0);
+    
+    // ('url', 'text'), 'options' and , 'title' add their quotes and separators
+    nwrote += url_size + bsize + 8;
+    if (OPTIONS_COL(options)) nwrote += header_size + 4;
+    if (options->split_sections) nwrote += title_len + 4;
+    output->batch_size += nwrote;
+    if (++output->batch_count >= options->batch_rows) end_file_batch(output);
+}
+
+static void add_row(const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry, const char *url, size_t start, size_t end, const char *title, size_t title_len) {
+#if ENABLE_SQLITE_OUTPUT
+    if (output->db) {
+        add_database_entry(options, output, entry, url, entry->buffer + start, end - start, title, title_len);
+        return;
+    }
+#endif
+    add_file_entry(options, output, entry, url, entry->buffer + start, end - start, title, title_len);
+}
+
+// true when the text is only whitespace, json_strict text has its newlines and control characters escaped
+static bool is_blank (const docbuilder_options *options, const char *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if ((unsigned char)buffer[i] <= ' ') continue;
+        if (options->json_strict && buffer[i] == '\\' && i + 1 < size && strchr("nrtbf", buffer[i+1])) {
+            ++i;
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+// with --split-sections a page is written as a row for the text before its first heading (when there
+// is any) followed by a row for each section, the url of a section is the url of the page#anchor
+// one row for each of the first words of the term, INSERT OR REPLACE makes a request sent again harmless
+static void add_autocomplete_term (const docbuilder_options *options, docbuilder_output *output, const char *url, const char *term, size_t term_len, int kind) {
+    char key[AUTOCOMPLETE_KEY_MAX * 4];
+    size_t key_len = autocomplete_normalize(term, (term_len < sizeof(key)) ? term_len : sizeof(key), key);
+    if (key_len == 0) return;
+    
+    const char *display = escape_text(options, term, term_len, &output->section_title);
+    size_t display_len = strlen(display);
+    const char *escaped_url = output_url(options, output, url);
+    size_t url_len = strlen(escaped_url);
+    
+    int word = 0;
+    for (size_t start = 0; start < key_len && word < AUTOCOMPLETE_WORDS; ++word) {
+        // a key is cut at a character boundary
+        size_t len = key_len - start;
+        if (len > AUTOCOMPLETE_KEY_MAX) {
+            len = AUTOCOMPLETE_KEY_MAX;
+            while (len > 0 && ((unsigned char)key[start + len] & 0xC0) == 0x80) --len;
+            while (len > 0 && key[start + len - 1] == ' ') --len;
+        }
+        int score = autocomplete_score(options, url, kind, word);
+        
+        #if ENABLE_SQLITE_OUTPUT
+        if (output->db) {
+            sqlite3_stmt *vm = output->autocomplete_vm;
+            int rc = sqlite3_bind_text(vm, 1, key + start, (int)len, SQLITE_STATIC);
+            if (rc == SQLITE_OK) rc = sqlite3_bind_text(vm, 2, escaped_url, (int)url_len, SQLITE_STATIC);
+            if (rc == SQLITE_OK) rc = sqlite3_bind_text(vm, 3, term, (int)term_len, SQLITE_STATIC);
+            if (rc == SQLITE_OK) rc = sqlite3_bind_int(vm, 4, score);
+            if (rc != SQLITE_OK) {
+                printf("add_autocomplete_term error: %s\n", sqlite3_errmsg(output->db));
+                exit(-10);
+            }
+            database_step(output, vm);
+        } else
+        #endif
+        {
+            // the key has no quotes, only the url and the term need the escapes
+            char *b = scratch_reserve(&output->autocomplete, output->autocomplete_len + len + url_len + display_len + 32);
+            size_t n = output->autocomplete_len;
+            if (output->autocomplete_rows) b[n++] = ',';
+            n += snprintf(b + n, len + url_len + display_len + 32, "('%.*s', '%s', '%s', %d)", (int)len, key + start, escaped_url, display, score);
+            output->autocomplete_len = n;
+            ++output->autocomplete_rows;
+        }
+        
+        const char *space = memchr(key + start, ' ', key_len - start);
+        if (!space) break;
+        start = space - key + 1;
+    }
+}
+
+static void add_autocomplete (const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry) {
+    if (entry->page_title_len) add_autocomplete_term(options, output, entry->url, entry->titles + entry->page_title, entry->page_title_len, 0);
+    
+    size_t url_len = strlen(entry->url);
+    for (size_t k = 0; k < entry->nsections; ++k) {
+        const md_section *section = &entry->sections[k];
+        char *url = scratch_reserve(&output->section_url, url_len + section->anchor_len + 2);
+        memcpy(url, entry->url, url_len);
+        url[url_len] = '#';
+        memcpy(url + url_len + 1, entry->titles + section->anchor, section->anchor_len);
+        url[url_len + 1 + section->anchor_len] = 0;
+        add_autocomplete_term(options, output, url, entry->titles + section->title, section->title_len, section->level);
+    }
+    if (output->autocomplete_len >= options->batch_bytes) autocomplete_flush(output);
+}
+
+static void add_entry(const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry) {
+    if (entry->skip) return;
+    if (!options->split_sections) {
+        add_row(options, output, entry, entry->url, 0, entry->size, NULL, 0);
+        return;
+    }
+    
+    size_t end = (entry->nsections) ? entry->sections[0].start : entry->size;
+    if (entry->nsections == 0 || !is_blank(options, entry->buffer, end)) add_row(options, output, entry, entry->url, 0, end, "", 0);
+    
+    size_t url_len = strlen(entry->url);
+    for (size_t k = 0; k < entry->nsections; ++k) {
+        const md_section *section = &entry->sections[k];
+        char *url = scratch_reserve(&output->section_url, url_len + section->anchor_len + 2);
+        memcpy(url, entry->url, url_len);
+        url[url_len] = '#';
+        memcpy(url + url_len + 1, entry->titles + section->anchor, section->anchor_len);
+        url[url_len + 1 + section->anchor_len] = 0;
+        
+        end = (k + 1 < entry->nsections) ? entry->sections[k+1].start : entry->size;
+        add_row(options, output, entry, url, section->start, end, entry->titles + section->title, section->title_len);
+    }
+}
+
+// with --dedup the rows of a removed page are moved to the first url of documentation_urls with the same
+// text (when there is any), the other urls of that text then point to it
+static void remove_alias(const docbuilder_options *options, docbuilder_output *output, const char *url) {
+    char *quoted = NULL;
+#if ENABLE_SQLITE_OUTPUT
+    if (output->db) url = quoted = sqlite3_mprintf("%q", url);
+#endif
+    if (!quoted) {
+        end_file_batch(output);
+        url = output_url(options, output, url);
+    }
+    
+    size_t blen = strlen(url) * 16 + 1024;
+    char *b = scratch_reserve(&output->statement, blen);
+    size_t nwrote = snprintf(b, blen, "UPDATE %s SET url = (SELECT min(url) FROM documentation_urls WHERE canonical = '%s') || substr(url, length('%s') + 1) WHERE ", fts_target(options), url, url);
+    if (options->split_sections) nwrote += snprintf(b + nwrote, blen - nwrote, "(url = '%s' OR (url >= '%s#' AND url < '%s$'))", url, url, url);
+    else nwrote += snprintf(b + nwrote, blen - nwrote, "url = '%s'", url);
+    nwrote += snprintf(b + nwrote, blen - nwrote, " AND EXISTS (SELECT 1 FROM documentation_urls WHERE canonical = '%s');\n", url);
+    nwrote += snprintf(b + nwrote, blen - nwrote, "UPDATE documentation_urls SET canonical = (SELECT min(url) FROM documentation_urls WHERE canonical = '%s') WHERE canonical = '%s' AND url <> (SELECT min(url) FROM documentation_urls WHERE canonical = '%s');\n", url, url, url);
+    nwrote += snprintf(b + nwrote, blen - nwrote, "DELETE FROM documentation_urls WHERE canonical = '%s' OR url = '%s';\n", url, url);
+    
+#if ENABLE_SQLITE_OUTPUT
+    if (quoted) {
+        database_exec(output, b);
+        sqlite3_free(quoted);
+        return;
+    }
+#endif
+    write_schema(output, b);
+}
+
+static void remove_entry(const docbuilder_options *options, docbuilder_output *output, const char *url) {
+    if (options->dedup) remove_alias(options, output, url);
+#if ENABLE_SQLITE_OUTPUT
+    if (output->db && options->autocomplete) {
+        char *sql = sqlite3_mprintf("DELETE FROM documentation_autocomplete WHERE url = %Q OR (url >= %Q || '#' AND url < %Q || '$');", url, url, url);
+        database_exec(output, sql);
+        sqlite3_free(sql);
+    }
+    if (output->db) {
+        if (sqlite3_bind_text(output->delete_vm, 1, url, -1, SQLITE_STATIC) != SQLITE_OK) {
+            printf("remove_entry error: %s\n", sqlite3_errmsg(output->db));
+            exit(-10);
+        }
+        database_step(output, output->delete_vm);
+        return;
+    }
+#endif
+    autocomplete_flush(output);
+    end_file_batch(output);
+    url = output_url(options, output, url);
+    size_t blen = strlen(url) * 3 + 128;
+    char *b = scratch_reserve(&output->statement, blen);
+    
+    // the rows of the sections of a page have the url of the page followed by #anchor
+    size_t nwrote;
+    if (options->split_sections) nwrote = snprintf(b, blen, "DELETE FROM %s WHERE url = '%s' OR (url >= '%s#' AND url < '%s$');", fts_target(options), url, url, url);
+    else nwrote = snprintf(b, blen, "DELETE FROM %s WHERE url = '%s';", fts_target(options), url);
+    write_line(output, b, nwrote, 1);
+    if (options->autocomplete) {
+        nwrote = snprintf(b, blen, "DELETE FROM documentation_autocomplete WHERE url = '%s' OR (url >= '%s#' AND url < '%s$');", url, url, url);
+        write_line(output, b, nwrote, 1);
+    }
+}
+
+static void free_entry (doc_entry *entry) {
+    free(entry->block);
+    memset(entry, 0, sizeof(doc_entry));
+}
+
+// copies the strings of the entry out of the scratch buffers so it can outlive the next parsed file
+static void detach_entry (doc_entry *entry) {
+    size_t sections_size = entry->nsections * sizeof(md_section);
+    size_t titles_size = entry->titles_len;
+    size_t url_size = (entry->url) ? strlen(entry->url) + 1 : 0;
+    size_t buffer_size = (entry->buffer) ? entry->size + 1 : 0;
+    size_t header_size = (entry->astro_header) ? entry->header_size + 1 : 0;
+    size_t fields_size = (entry->fields) ? fields_length(entry) : 0;
+    size_t size = sections_size + titles_size + url_size + buffer_size + header_size + fields_size;
+    if (size == 0) return;
+    
+    char *block = (char *)malloc(size);
+    if (!block) {
+        printf("Not enough memory to allocate %zu bytes.", size);
+        exit(-3);
+    }
+    
+    // the sections first, the block is aligned for them
+    char *p = block;
+    if (sections_size) {memcpy(p, entry->sections, sections_size); entry->sections = (const md_section *)p; p += sections_size;}
+    if (titles_size) {memcpy(p, entry->titles, titles_size); entry->titles = p; p += titles_size;}
+    if (url_size) {memcpy(p, entry->url, url_size); entry->url = p; p += url_size;}
+    if (buffer_size) {memcpy(p, entry->buffer, buffer_size); entry->buffer = p; p += buffer_size;}
+    if (header_size) {memcpy(p, entry->astro_header, header_size); entry->astro_header = p; p += header_size;}
+    if (fields_size) {memcpy(p, entry->fields, fields_size); entry->fields = p;}
+    entry->block = block;
+}
+
+// builds the url of the page from the slug in its front matter or from its path
+static const char *entry_url (const docbuilder_options *options, const md_parser *parser, const char *full_path, scratch_buffer *scratch) {
+    if(options->path_using_slug && parser->has_slug){
+        size_t base_len = strlen(options->base_url);
+        char *url = scratch_reserve(scratch, base_len + parser->slug_len + 1);
+        memcpy(url, options->base_url, base_len);
+        memcpy(url + base_len, parser->slug->data, parser->slug_len + 1);
+        return url;
+    }
+    return file_buildurl(options->base_url, options->src_path, full_path, scratch);
+}
+
+// hash of everything written for the page but its url, 0 is never used
+static uint64_t dedup_key (const docbuilder_options *options, const doc_entry *entry) {
+    uint64_t key = hash_content(HASH_INIT, entry->buffer, entry->size);
+    if (OPTIONS_COL(options) || options->nfm_columns) key = hash_content(key, entry->astro_header, entry->header_size);
+    if (entry->titles_len) key = hash_content(key, entry->titles, entry->titles_len);
+    return (key) ? key : 1;
+}
+
+// a page larger than stream_threshold is parsed while it is written
+static bool file_streamed (const docbuilder_options *options, const struct stat *sb) {
+    // the sections are written after the whole page has been parsed, so a split page is never streamed
+    return options->format != FORMAT_SQLITE && !options->split_sections && (size_t)sb->st_size > options->stream_threshold;
+}
+
+// the front matter title is added after the headings in titles (not in the dedup key, it is not indexed)
+static void entry_page_title (md_parser *parser, doc_entry *entry) {
+    size_t len = 0;
+    const char *title = md_header_title(parser, &len);
+    if (!title) return;
+    char *titles = scratch_reserve(parser->titles, parser->titles_len + len);
+    for (size_t i = 0; i < len; ++i) titles[parser->titles_len + i] = ((unsigned char)title[i] < ' ') ? ' ' : title[i];
+    entry->titles = titles;
+    entry->page_title = parser->titles_len;
+    entry->page_title_len = len;
+    parser->titles_len += len;
+    entry->titles_len = parser->titles_len;
+}
+
+// parses a single md/mdx file, it doesn't touch any shared state so it can be safely called from any
+// thread as long as each thread uses its own scratch (the entry is valid until the next call)
+// the data of a prefetched file is freed by the caller unless the entry took it (prefetch->data is NULL)
+static void process_file (const docbuilder_options *options, const manifest *previous, const char *full_path, file_scratch *scratch, file_prefetch *prefetch, doc_entry *entry) {
+    memset(entry, 0, sizeof(doc_entry));
+    entry->skip = true;
+    stats_time t = stats_now(options);
+    
+    const char *relative_path = file_relpath(options->src_path, full_path);
+    const manifest_record *record = (previous) ? manifest_lookup(previous, relative_path) : NULL;
+    struct stat sb;
+    bool opened = (prefetch && prefetch->opened);
+    if (opened) sb = prefetch->sb;
+    
+    // same size and mtime of the previous run, the file is not even read
+    if (record && (opened || stat(full_path, &sb) == 0) && manifest_same_stat(record, &sb)) {
+        entry->path = relative_path;
+        entry->url = (record->url[0]) ? record->url : NULL;
+        entry->fsize = record->size;
+        entry->mtime_sec = record->mtime_sec;
+        entry->mtime_nsec = record->mtime_nsec;
+        entry->hash = record->hash;
+        entry->key = record->key;
+        entry->unchanged = true;
+        stats_lap(options, &entry->stats.read, &t);
+        return;
+    }
+    
+    // a file read ahead is already in memory
+    int fd = -1;
+    if (!prefetch || !prefetch->data) {
+        fd = open(full_path, O_RDONLY);
+        if (fd < 0) return;
+        if (fstat(fd, &sb) < 0) {
+            close(fd);
+            return;
+        }
+    }
+    
+    entry->path = relative_path;
+    entry->full_path = full_path;
+    entry->fsize = (int64_t)sb.st_size;
+    entry->mtime_sec = (int64_t)STAT_MTIME_SEC(&sb);
+    entry->mtime_nsec = (long)STAT_MTIME_NSEC(&sb);
+    
+    if (fd >= 0 && file_streamed(options, &sb)) {
+        // too large to be loaded in memory, it will be parsed while it is written
+        if (record && record->size == entry->fsize && file_hash_fd(fd, &scratch->source, &entry->hash) && record->hash == entry->hash) {
+            entry->url = (record->url[0]) ? record->url : NULL;
+            entry->key = record->key;
+            entry->unchanged = true;
+        } else {
+            entry->streamed = true;
+            entry->skip = false;
+        }
+        close(fd);
+        stats_lap(options, &entry->stats.read, &t);
+        return;
+    }
+    
+    // load md source code
+    size_t size = 0;
+    bool mapped = false;
+    char *prefetched = NULL;
+    char *source_code;
+    if (fd < 0) {
+        source_code = prefetched = prefetch->data;
+        size = prefetch->size;
+        prefetch->data = NULL;
+    } else {
+        source_code = (options->use_mmap) ? file_map_fd(fd, &sb, &scratch->source, &size, &mapped) : file_read_fd(fd, &sb, &scratch->source, &size);
+        close(fd);
+    }
+    if (!source_code) {
+        entry->path = NULL;
+        return;
+    }
+    size_t source_size = size;
+    entry->hash = hash_bytes(source_code, size);
+    stats_lap(options, &entry->stats.read, &t);
+    
+    // touched but with the same content (like a fresh git checkout)
+    if (record && record->hash == entry->hash && record->size == entry->fsize) {
+        entry->url = (record->url[0]) ? record->url : NULL;
+        entry->key = record->key;
+        entry->unchanged = true;
+        file_unmap(source_code, source_size, mapped);
+        free(prefetched);
+        return;
+    }
+    
+    // each char can be escaped at most once (' -> '' or " -> \"), the front matter can't be larger than the page.
+    // A json string escapes the control characters too, then the size is counted instead of using the worst case
+    char *buffer = scratch_reserve(&scratch->buffer, ((options->json_strict) ? md_escaped_size(options, source_code, size) : size * 2) + 1);
+    scratch_reserve(&scratch->header, size + 1);
+    
+    md_parser parser;
+    md_parser_init(&parser, &scratch->header, &scratch->slug);
+    if (options->split_sections || options->autocomplete) {
+        parser.sections = &scratch->sections;
+        parser.titles = &scratch->titles;
+    }
+    process_md(options, &parser, source_code, size, true, buffer, &size);
+    file_unmap(source_code, source_size, mapped);
+    free(prefetched);
+    stats_lap(options, &entry->stats.parse, &t);
+    if (parser.is_draft) return;
+    
+    char *astro_header = parser.header->data;
+    size_t header_size = parser.header_len;
+    // a page without front matter has {} as options, in every format
+    bool has_options = OPTIONS_COL(options);
+    if (has_options || options->nfm_columns) {
+        size_t json_len = 0;
+        char *json = process_front_matter(options, astro_header, header_size, (has_options) ? &scratch->json : NULL, &json_len, &scratch->fields, entry);
+        if (has_options) {
+            astro_header = json;
+            header_size = json_len;
+        }
+    }
+    stats_lap(options, &entry->stats.json, &t);
+    
+    entry->url = entry_url(options, &parser, full_path, &scratch->url);
+    entry->buffer = buffer;
+    entry->size = size;
+    entry->astro_header = astro_header;
+    entry->header_size = header_size;
+    if (parser.sections) {
+        entry->sections = (const md_section *)scratch->sections.data;
+        entry->nsections = parser.nsections;
+        entry->titles = scratch->titles.data;
+        entry->titles_len = parser.titles_len;
+    }
+    if (options->dedup) entry->key = dedup_key(options, entry);
+    if (options->autocomplete) entry_page_title(&parser, entry);
+    stats_lap(options, &entry->stats.parse, &t);
+    entry->skip = false;
+}
+
+// Parses a page larger than stream_threshold in chunks and writes its INSERT statement while reading
+// it: the statement prefix is written as soon as the front matter is over (url and draft status are
+// known), then the text of each chunk, so the memory used doesn't depend on the size of the page.
+static void stream_file_entry (const docbuilder_options *options, docbuilder_output *output, doc_entry *entry) {
+    file_scratch *scratch = &output->scratch;
+    entry->skip = true;
+    end_file_batch(output);
+    
+    int fd = open(entry->full_path, O_RDONLY);
+    if (fd < 0) {
+        printf("Unable to read file %s.", entry->full_path);
+        exit(-6);
+    }
+    
+    // the window keeps room for the longest line inspected by the parser after a whole chunk
+    size_t capacity = MD_CHUNK_SIZE + MD_MAX_LINE;
+    char *window = scratch_reserve(&scratch->source, capacity + MD_LOOKAHEAD);
+    char *buffer = scratch_reserve(&scratch->buffer, capacity * ((options->json_strict) ? 6 : 2) + 1);
+    
+    md_parser parser;
+    md_parser_init(&parser, &scratch->header, &scratch->slug);
+    if (options->autocomplete) {
+        parser.sections = &scratch->sections;
+        parser.titles = &scratch->titles;
+    }
+    
+    uint64_t hash = HASH_INIT;
+    size_t len = 0;
+    bool eof = false, started = false;
+    while (!parser.done) {
+        while (!eof && len < capacity) {
+            ssize_t nread = read(fd, window + len, capacity - len);
+            if (nread < 0) {
+                printf("Unable to read file %s.", entry->full_path);
+                exit(-6);
+            }
+            if (nread == 0) eof = true;
+            hash = hash_update(hash, window + len, (size_t)nread);
+            len += (size_t)nread;
+        }
+        if (eof) memset(window + len, 0, MD_LOOKAHEAD);
+        
+        size_t nout = 0;
+        size_t consumed = process_md(options, &parser, window, len, eof, buffer, &nout);
+        if (parser.is_draft) break;
+        
+        if (!started && (md_parser_header_done(&parser) || parser.done)) {
+            entry->url = entry_url(options, &parser, entry->full_path, &scratch->url);
+            write_line(output, "INSERT INTO ", 12, 0);
+            write_line(output, fts_target(options), -1, 0);
+            write_line(output, " (", 2, 0);
+            write_line(output, options->columns, -1, 0);
+            write_line(output, ") VALUES ('", 11, 0);
+            write_line(output, output_url(options, output, entry->url), -1, 0);
+            write_line(output, "', '", 4, 0);
+            started = true;
+        }
+        if (nout) write_line(output, buffer, nout, 0);
+        entry->size += nout;
+        
+        memmove(window, window + consumed, len - consumed);
+        len -= consumed;
+    }
+    
+    // the content hash in the manifest is always computed on the whole file
+    while (!eof) {
+        ssize_t nread = read(fd, window, capacity);
+        if (nread <= 0) break;
+        hash = hash_update(hash, window, (size_t)nread);
+    }
+    close(fd);
+    entry->hash = hash;
+    if (parser.is_draft) return;
+    
+    size_t header_size = 0;
+    char *astro_header = NULL;
+    if (OPTIONS_COL(options) || options->nfm_columns) {
+        astro_header = process_front_matter(options, parser.header->data, parser.header_len, (OPTIONS_COL(options)) ? &scratch->json : NULL, &header_size, &scratch->fields, entry);
+    }
+    if (OPTIONS_COL(options)) {
+        entry->header_size = header_size;
+        write_line(output, "', '", 4, 0);
+        write_line(output, astro_header, header_size, 0);
+    }
+    write_line(output, "'", 1, 0);
+    write_fields(options, output, entry);
+    write_line(output, ");", 2, 1);
+    if (parser.sections) {
+        entry->sections = (const md_section *)scratch->sections.data;
+        entry->nsections = parser.nsections;
+        entry->titles = scratch->titles.data;
+        entry->titles_len = parser.titles_len;
+        entry_page_title(&parser, entry);
+    }
+    entry->skip = false;
+}
+
+// adds the url of a page with the same text of canonical, which can be itself in documentation_urls
+static void add_alias (const docbuilder_options *options, docbuilder_output *output, const char *url, const char *canonical) {
+#if ENABLE_SQLITE_OUTPUT
+    if (output->db) {
+        char *sql = sqlite3_mprintf("INSERT INTO documentation_urls (url, canonical) VALUES (%Q, coalesce((SELECT canonical FROM documentation_urls WHERE url = %Q), %Q));", url, canonical, canonical);
+        database_exec(output, sql);
+        sqlite3_free(sql);
+        return;
+    }
+#endif
+    end_file_batch(output);
+    write_line(output, "INSERT INTO documentation_urls (url, canonical) VALUES ('", -1, 0);
+    write_line(output, output_url(options, output, url), -1, 0);
+    write_line(output, "', coalesce((SELECT canonical FROM documentation_urls WHERE url = '", -1, 0);
+    canonical = output_url(options, output, canonical);
+    write_line(output, canonical, -1, 0);
+    write_line(output, "'), '", 5, 0);
+    write_line(output, canonical, -1, 0);
+    write_line(output, "'));", 4, 1);
+}
+
+// the page of the record is parsed again, the same key with a different text is a collision
+static bool dedup_same_text (const docbuilder_options *options, docbuilder_output *output, const dedup_record *r, const doc_entry *entry) {
+    size_t src_len = strlen(options->src_path);
+    size_t len = src_len + strlen(r->path) + 2;
+    char *full_path = (char *)malloc(len);
+    if (!full_path) exit(-11);
+    snprintf(full_path, len, "%s%s%s", options->src_path, (src_len && options->src_path[src_len-1] != PATH_SEPARATOR) ? "/" : "", r->path);
+    
+    // a page of the previous run must still be the same file, otherwise it is written again later in this run
+    struct stat sb;
+    const manifest_record *record = r->record;
+    if (record && (stat(full_path, &sb) != 0 || !manifest_same_stat(record, &sb))) {
+        free(full_path);
+        return false;
+    }
+    
+    doc_entry other;
+    process_file(options, NULL, full_path, &output->dedup_scratch, NULL, &other);
+    free(full_path);
+    
+    if (other.skip || other.streamed || other.key != entry->key) return false;
+    if (other.size != entry->size || memcmp(other.buffer, entry->buffer, entry->size) != 0) return false;
+    if ((OPTIONS_COL(options) || options->nfm_columns) && (other.header_size != entry->header_size || memcmp(other.astro_header, entry->astro_header, entry->header_size) != 0)) return false;
+    return (other.titles_len == entry->titles_len && (entry->titles_len == 0 || memcmp(other.titles, entry->titles, entry->titles_len) == 0));
+}
+
+// true when the page has the same text of a page already indexed and only its url has been written
+static bool dedup_entry (const docbuilder_options *options, docbuilder_output *output, const doc_entry *entry) {
+    if (!options->dedup || entry->skip || !entry->key) return false;
+    
+    dedup_record *r = dedup_lookup(&output->dedup, entry->key);
+    if (r && strcmp(r->url, entry->url) != 0 && dedup_same_text(options, output, r, entry)) {
+        add_alias(options, output, entry->url, r->url);
+        return true;
+    }
+    
+    // the first page with this text, a page of the previous run not indexed anymore is replaced
+    if (!r || r->record) dedup_insert(&output->dedup, entry->key, entry->url, entry->path, NULL);
+    return false;
+}
+
+// writes the entry and its manifest line, in incremental mode the previous row of a changed page is removed first
+static void write_entry(const docbuilder_options *options, docbuilder_output *output, doc_entry *entry) {
+    manifest_record *record = (output->previous && entry->path) ? manifest_lookup(output->previous, entry->path) : NULL;
+    if (record) record->seen = true;
+    stats_time t = stats_now(options);
+    bool alias = false;
+    
+    if (!entry->unchanged) {
+        if (record && record->url[0]) remove_entry(options, output, record->url);
+        if (entry->streamed) stream_file_entry(options, output, entry);
+        else if (!(alias = dedup_entry(options, output, entry))) add_entry(options, output, entry);
+        if (options->autocomplete && !entry->skip && entry->url) add_autocomplete(options, output, entry);
+        #if ENABLE_UPLOAD
+        if (output->upload && !entry->skip && entry->url) upload_add_url(output->upload, entry->url);
+        #endif
+        stats_lap(options, &entry->stats.write, &t);
+        upload_page_done(output);
+        #if ENABLE_UPLOAD
+        if (output->upload) stats_lap(options, &output->stats.upload, &t);
+        #endif
+    } else if (entry->key && entry->url) {
+        // an unchanged page is still indexed (or is an alias), it can be the canonical page of the next ones
+        dedup_record *r = dedup_lookup(&output->dedup, entry->key);
+        if (!r || r->record) dedup_insert(&output->dedup, entry->key, entry->url, entry->path, NULL);
+    }
+    
+    if (output->previous && entry->url) {
+        char *url = strdup(entry->url);
+        if (!url) exit(-11);
+        doc_list_add(&output->urls, url);
+    }
+    manifest_add(options, output, entry);
+    stats_add_entry(options, output, entry, alias);
+}
+
+// removes the pages that are in the previous manifest but not in the docs anymore
+static void remove_deleted_entries(const docbuilder_options *options, docbuilder_output *output) {
+    manifest *previous = output->previous;
+    if (!previous) return;
+    
+    qsort(output->urls.paths, output->urls.count, sizeof(char *), doc_list_compare);
+    for (size_t i = 0; i < previous->capacity; ++i) {
+        manifest_record *record = &previous->records[i];
+        if (!record->path || record->seen || !record->url[0]) continue;
+        
+        // a moved page can keep its url, its new row must not be removed
+        if (output->urls.count && bsearch(&record->url, output->urls.paths, output->urls.count, sizeof(char *), doc_list_compare)) continue;
+        remove_entry(options, output, record->url);
+        upload_page_done(output);
+    }
+}
+
+// MARK: - Walk -
+
+// The folders are walked depth-first with an explicit stack of open directories: the entries are opened
+// relative to their folder (openat) and the type comes from d_type, fstatat is needed only on the file
+// systems that do not fill it. With --sort the entries of each folder are read at once and visited in
+// byte order, so the output does not depend on the order of the file system.
+
+typedef struct {
+    const char      *name;
+    size_t          offset;         // of the name in walk_frame.names, the buffer moves while it grows
+    unsigned char   type;
+} walk_entry;
+
+typedef struct {
+    DIRREF          dir;
+    size_t          path_len;       // length of the folder path, separator included
+    scratch_buffer  names;          // sorted walk only
+    walk_entry      *entries;
+    size_t          count;
+    size_t          capacity;
+    size_t          next;
+} walk_frame;
+
+typedef struct {
+    walk_frame      *frames;
+    size_t          count;
+    size_t          capacity;
+} walk_stack;
+
+static int walk_entry_compare (const void *a, const void *b) {
+    return strcmp(((const walk_entry *)a)->name, ((const walk_entry *)b)->name);
+}
+
+static const char *walk_read (DIRREF dir, unsigned char *type) {
+    struct dirent *d;
+    while ((d = readdir(dir))) {
+        if (d->d_name[0] == '\0') continue;
+        if (d->d_name[0] == '.') continue;
+        //if (use_front_matter && d->d_name[0] == '_') continue; // skipping files starting with _ like astro does
+        *type = d->d_type;
+        return d->d_name;
+    }
+    return NULL;
+}
+
+static void walk_load (walk_frame *frame) {
+    const char *name;
+    unsigned char type;
+    size_t used = 0;
+    
+    while ((name = walk_read(frame->dir, &type))) {
+        if (frame->count == frame->capacity) {
+            size_t capacity = (frame->capacity) ? frame->capacity * 2 : 64;
+            walk_entry *entries = (walk_entry *)realloc(frame->entries, capacity * sizeof(walk_entry));
+            if (!entries) {
+                printf("Not enough memory to allocate %zu bytes.", capacity * sizeof(walk_entry));
+                exit(-3);
+            }
+            frame->entries = entries;
+            frame->capacity = capacity;
+        }
+        size_t len = strlen(name) + 1;
+        memcpy(scratch_reserve(&frame->names, used + len) + used, name, len);
+        frame->entries[frame->count++] = (walk_entry){.offset = used, .type = type};
+        used += len;
+    }
+    
+    for (size_t i = 0; i < frame->count; ++i) frame->entries[i].name = frame->names.data + frame->entries[i].offset;
+    qsort(frame->entries, frame->count, sizeof(walk_entry), walk_entry_compare);
+}
+
+// pushes the folder whose path (path_len bytes) is in path, fd is already open on it
+static bool walk_push (const docbuilder_options *options, walk_stack *stack, int fd, scratch_buffer *path, size_t path_len) {
+    DIRREF dir = (fd >= 0) ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    
+    if (stack->count == stack->capacity) {
+        size_t capacity = (stack->capacity) ? stack->capacity * 2 : 16;
+        walk_frame *frames = (walk_frame *)realloc(stack->frames, capacity * sizeof(walk_frame));
+        if (!frames) {
+            printf("Not enough memory to allocate %zu bytes.", capacity * sizeof(walk_frame));
+            exit(-3);
+        }
+        memset(frames + stack->capacity, 0, (capacity - stack->capacity) * sizeof(walk_frame));
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    
+    // check if PATH_SEPARATOR exists in the folder path
+    if ((path_len) && (path->data[path_len-1] != PATH_SEPARATOR)) {
+        scratch_reserve(path, path_len + 2);
+        path->data[path_len++] = PATH_SEPARATOR;
+    }
+    
+    // the buffers of a frame are kept for the next folder at the same depth
+    walk_frame *frame = &stack->frames[stack->count++];
+    frame->dir = dir;
+    frame->path_len = path_len;
+    frame->count = 0;
+    frame->next = 0;
+    if (options->sort_walk) walk_load(frame);
+    return true;
+}
+
+// returns the next entry of the folder on top of the stack, NULL when the folder is over
+static const char *walk_next (const docbuilder_options *options, walk_frame *frame, unsigned char *type) {
+    if (!options->sort_walk) return walk_read(frame->dir, type);
+    if (frame->next == frame->count) return NULL;
+    
+    walk_entry *entry = &frame->entries[frame->next++];
+    *type = entry->type;
+    return entry->name;
+}
+
+static void walk_free (walk_stack *stack) {
+    for (size_t i = 0; i < stack->capacity; ++i) {
+        walk_frame *frame = &stack->frames[i];
+        if (i < stack->count) closedir(frame->dir);
+        scratch_free(&frame->names);
+        free(frame->entries);
+    }
+    free(stack->frames);
+}
+
+// walks the folder in path, when list is NULL each file is processed and written immediately
+// otherwise its path is appended to list (preserving the walk order) to be processed later
+// path is a single buffer reused for the whole walk, each level appends its entries after path_len
+static void scan_docs (const docbuilder_options *options, docbuilder_output *output, doc_list *list, file_scratch *scratch, scratch_buffer *path, size_t path_len) {
+    // only the time spent in the directory calls is counted as walk, not the pages written in between
+    stats_time *walk = (output) ? &output->stats.walk : NULL;
+    stats_time t = stats_now(options);
+    walk_stack stack = {0};
+    if (!walk_push(options, &stack, open(path->data, O_RDONLY | O_DIRECTORY | O_CLOEXEC), path, path_len)) return;
+    
+    while (stack.count) {
+        walk_frame *frame = &stack.frames[stack.count - 1];
+        unsigned char type;
+        const char *target_file = walk_next(options, frame, &type);
+        if (!target_file) {
+            closedir(frame->dir);
+            --stack.count;
+            continue;
+        }
+        
+        size_t name_len = strlen(target_file);
+        char *full_path = scratch_reserve(path, frame->path_len + name_len + 1);
+        memcpy(full_path + frame->path_len, target_file, name_len + 1);
+        
+        // symbolic links are not followed into folders, as lstat did
+        if (type == DT_UNKNOWN) {
+            struct stat buf;
+            type = (fstatat(dirfd(frame->dir), target_file, &buf, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(buf.st_mode)) ? DT_DIR : DT_REG;
+        }
+        
+        // if file is a folder then continue the walk inside it
+        if (type == DT_DIR) {
+            int fd = openat(dirfd(frame->dir), target_file, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            walk_push(options, &stack, fd, path, frame->path_len + name_len);
+            continue;
+        }
+        stats_lap(options, walk, &t);
+        
+        // test only files with a .md or mdx extension
+        if ((strstr(full_path, ".md") == NULL) && (strstr(full_path, ".mdx") == NULL)) {
+            if (output) ++output->stats.not_markdown;
+            continue;
+        }
+        
+        if (list) {
+            char *copy = strdup(full_path);
+            if (!copy) {
+                printf("Not enough memory to allocate %zu bytes.", frame->path_len + name_len + 1);
+                exit(-3);
+            }
+            doc_list_add(list, copy);
+            continue;
+        }
+        
+        doc_entry entry;
+        process_file(options, output->previous, full_path, scratch, NULL, &entry);
+        write_entry(options, output, &entry);
+        
+        //DEBUG
+        //printf("url:   %s\n", entry.url);
+        //printf("%s\n", full_path);
+        //printf("OUTPUT:\n%s\n", entry.buffer);
+        
+        free_entry(&entry);
+        t = stats_now(options);
+    }
+    stats_lap(options, walk, &t);
+    walk_free(&stack);
+}
+
+// MARK: - Read-ahead -
+
+// With --read-ahead=N a reader thread opens and reads the files of the walk list in walk order with
+// io_uring, keeping up to N of them in flight or waiting for their parser: on a cold page cache the
+// storage works on many files at once instead of one for each parser. The unchanged pages and the
+// streamed ones are only opened. A parser that reaches a file not claimed by the reader yet (a stolen
+// job, or every job when io_uring is not available) reads it itself.
+
+#if ENABLE_IO_URING
+typedef struct {
+    int                     fd;
+    unsigned                *sq_tail;
+    unsigned                sq_mask;
+    unsigned                *sq_array;
+    unsigned                *cq_head;
+    unsigned                *cq_tail;
+    unsigned                cq_mask;
+    struct io_uring_sqe     *sqes;
+    struct io_uring_cqe     *cqes;
+    void                    *sq_ring;
+    void                    *cq_ring;
+    size_t                  sq_ring_size;
+    size_t                  cq_ring_size;
+    size_t                  sqes_size;
+    unsigned                queued;         // sqes not submitted yet
+} uring;
+
+static void uring_free (uring *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(uring));
+    ring->fd = -1;
+}
+
+static bool uring_init (uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(uring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return false;
+    
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+    
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = (single) ? ring->sq_ring : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_free(ring);
+        return false;
+    }
+    
+    char *sq = (char *)ring->sq_ring;
+    char *cq = (char *)ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// the caller never queues more sqes than the entries of the ring before submitting them
+static struct io_uring_sqe *uring_sqe (uring *ring, uint8_t opcode, int fd, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->queued;
+    return sqe;
+}
+
+// submits the queued sqes and waits until at least one of them is completed
+static bool uring_submit_wait (uring *ring) {
+    while (1) {
+        int rc = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc >= 0) {
+            ring->queued -= (unsigned)rc;
+            return true;
         }
-        
-        // copy character as-is
-        astro_header[j++] = c;
+        if (errno != EINTR) return false;
     }
+}
 
-    astro_header[j++] = '\\';
-    astro_header[j++] = '\"';
-    astro_header[j++] = '\n';
-    astro_header[j++] = '}';
-    astro_header[j++] = '\n';
-    astro_header[j] = 0;
-    *header_len = j;
-    
-    strcpy(input, astro_header);
-    free(astro_header);
+static struct io_uring_cqe *uring_cqe (uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & ring->cq_mask];
 }
 
-// MARK: -
+static void uring_cqe_seen (uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+#endif
 
-static void write_line (const char *buffer, size_t blen, int add_newline) {
-    if (blen == -1) blen = strlen(buffer);
-    
-    size_t nwrote = fwrite(buffer, blen, 1, f);
-    if (add_newline) fwrite("\n", 1, 1, f);
-    
-    if (nwrote != 1) {
-        printf("Write fails: %s.", buffer);
-        exit(-6);
+#define READ_AHEAD_NONE             -1      // not claimed yet
+#define READ_AHEAD_PARSER           -2      // read by its parser
+
+typedef struct {
+    file_prefetch   file;
+    size_t          job;
+    int             fd;
+    size_t          offset;         // bytes already read
+    bool            ready;
+} read_ahead_slot;
+
+typedef struct {
+    const docbuilder_options    *options;
+    const manifest              *previous;
+    const doc_list              *list;
+    int                         *job_slot;      // slot of each job of the list, or READ_AHEAD_NONE/PARSER
+    read_ahead_slot             *slots;         // one for each file claimed by the reader and not taken yet
+    int                         *free_slots;
+    int                         nfree;
+    int                         depth;
+    int                         batch;          // free slots that wake up the reader
+    int                         waiting;        // parsers waiting for their slot
+    pthread_mutex_t             lock;
+    pthread_cond_t              ready;          // a slot has been read
+    pthread_cond_t              taken;          // a parser took its slot
+    pthread_t                   thread;
+    #if ENABLE_IO_URING
+    uring                       ring;
+    #endif
+} read_ahead;
+
+#if ENABLE_IO_URING
+static void read_ahead_done (read_ahead *ahead, read_ahead_slot *slot, bool read) {
+    if (!read) {
+        free(slot->file.data);
+        slot->file.data = NULL;
     }
+    if (slot->fd >= 0) close(slot->fd);
+    slot->fd = -1;
+    
+    pthread_mutex_lock(&ahead->lock);
+    slot->ready = true;
+    if (ahead->waiting) pthread_cond_broadcast(&ahead->ready);
+    pthread_mutex_unlock(&ahead->lock);
 }
 
-#if GENERATE_SQLITE_DATABASE
-static void create_database (const char *path) {
-    file_delete(path);
+static void read_ahead_queue_read (read_ahead *ahead, int index) {
+    read_ahead_slot *slot = &ahead->slots[index];
+    struct io_uring_sqe *sqe = uring_sqe(&ahead->ring, IORING_OP_READ, slot->fd, (uint64_t)index);
+    sqe->addr = (uint64_t)(uintptr_t)(slot->file.data + slot->offset);
+    sqe->len = (uint32_t)(slot->file.size - slot->offset);
+    sqe->off = (uint64_t)slot->offset;
+}
+
+// the file is open: the pages that the parser would not read are only stat-ed, the others are read
+static void read_ahead_opened (read_ahead *ahead, int index) {
+    read_ahead_slot *slot = &ahead->slots[index];
+    struct stat *sb = &slot->file.sb;
+    if (fstat(slot->fd, sb) < 0) {
+        read_ahead_done(ahead, slot, false);
+        return;
+    }
+    slot->file.opened = true;
     
-    int rc = sqlite3_open(path, &db);
-    if (rc != SQLITE_OK) {
-        printf("Unable to create sqlite database %s.", (db) ? sqlite3_errmsg(db) : "");
-        exit(-2);
+    const char *path = ahead->list->paths[slot->job];
+    const manifest_record *record = (ahead->previous) ? manifest_lookup(ahead->previous, file_relpath(ahead->options->src_path, path)) : NULL;
+    if ((record && manifest_same_stat(record, sb)) || file_streamed(ahead->options, sb) || sb->st_size > UINT32_MAX) {
+        read_ahead_done(ahead, slot, false);
+        return;
     }
     
-    rc = sqlite3_exec(db, "CREATE VIRTUAL TABLE IF NOT EXISTS documentation USING fts5 (url, content);", NULL, NULL, NULL);
-    if (rc != SQLITE_OK) {
-        printf("Unable to documentation table (%s).", sqlite3_errmsg(db));
+    // two terminators because the parser peeks one byte past the end
+    size_t fsize = (size_t)sb->st_size;
+    slot->file.data = (char *)malloc(fsize + 2);
+    if (!slot->file.data) {
+        printf("Not enough memory to allocate %zu bytes.", fsize + 2);
         exit(-3);
     }
+    slot->file.data[fsize] = 0;
+    slot->file.data[fsize + 1] = 0;
+    slot->file.size = fsize;
+    slot->offset = 0;
+    
+    if (fsize == 0) read_ahead_done(ahead, slot, true);
+    else read_ahead_queue_read(ahead, index);
 }
-#endif
 
-static void create_file (const char *path) {
-    file_delete(path);
-    
-    f = fopen(path, "w");
-    if (!f) {
-        printf("Unable to create sql file :%s.", path);
-        exit(-2);
-    }
-    
-    if (create_db) {
-        write_line("CREATE DATABASE documentation.sqlite IF NOT EXISTS;", -1, 1);
-    }
+static void *read_ahead_run (void *arg) {
+    read_ahead *ahead = (read_ahead *)arg;
+    const doc_list *list = ahead->list;
+    size_t next = 0;
+    int inflight = 0;
     
-    if (use_database) {
-        write_line("USE DATABASE documentation.sqlite;", -1, 1);
+    while (1) {
+        // claim the next jobs of the walk while there are free slots
+        pthread_mutex_lock(&ahead->lock);
+        while (next < list->count && ahead->nfree > 0) {
+            size_t job = next++;
+            if (ahead->job_slot[job] != READ_AHEAD_NONE) continue;
+            
+            int index = ahead->free_slots[--ahead->nfree];
+            read_ahead_slot *slot = &ahead->slots[index];
+            memset(slot, 0, sizeof(read_ahead_slot));
+            slot->job = job;
+            slot->fd = -1;
+            ahead->job_slot[job] = index;
+            
+            struct io_uring_sqe *sqe = uring_sqe(&ahead->ring, IORING_OP_OPENAT, AT_FDCWD, (uint64_t)index);
+            sqe->addr = (uint64_t)(uintptr_t)list->paths[job];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            ++inflight;
+        }
+        if (inflight == 0) {
+            bool over = (next == list->count);
+            // every slot is read and waits for its parser, the reader sleeps until a batch of them is taken
+            if (!over) {
+                while (ahead->nfree < ahead->batch) pthread_cond_wait(&ahead->taken, &ahead->lock);
+            }
+            pthread_mutex_unlock(&ahead->lock);
+            if (over) break;
+            continue;
+        }
+        pthread_mutex_unlock(&ahead->lock);
+        
+        if (!uring_submit_wait(&ahead->ring)) {
+            printf("Unable to read ahead: io_uring_enter fails with error %d.", errno);
+            exit(-14);
+        }
+        
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(&ahead->ring))) {
+            int index = (int)cqe->user_data;
+            int res = cqe->res;
+            uring_cqe_seen(&ahead->ring);
+            
+            read_ahead_slot *slot = &ahead->slots[index];
+            if (slot->fd < 0) {
+                // the file could not be opened, its parser tries again and skips it
+                if (res < 0) {
+                    read_ahead_done(ahead, slot, false);
+                    --inflight;
+                    continue;
+                }
+                slot->fd = res;
+                read_ahead_opened(ahead, index);
+                if (slot->ready) --inflight;
+                continue;
+            }
+            
+            // a read error or a file shorter than its size: the parser reads it again
+            if (res <= 0) {
+                read_ahead_done(ahead, slot, false);
+                --inflight;
+                continue;
+            }
+            slot->offset += (size_t)res;
+            if (slot->offset < slot->file.size) {
+                read_ahead_queue_read(ahead, index);
+                continue;
+            }
+            read_ahead_done(ahead, slot, true);
+            --inflight;
+        }
     }
+    return NULL;
+}
+#endif
+
+// returns false when io_uring is not available, the parsers read the files themselves
+static bool read_ahead_start (read_ahead *ahead, const docbuilder_options *options, const manifest *previous, const doc_list *list) {
+    #if ENABLE_IO_URING
+    memset(ahead, 0, sizeof(read_ahead));
+    int depth = options->read_ahead;
+    if (depth <= 0 || list->count == 0) return false;
+    if (depth > MAX_READ_AHEAD) depth = MAX_READ_AHEAD;
+    if (!uring_init(&ahead->ring, (unsigned)depth)) return false;
     
-    if (use_transaction) {
-        write_line("BEGIN TRANSACTION;", -1, 1);
+    ahead->options = options;
+    ahead->previous = previous;
+    ahead->list = list;
+    ahead->depth = depth;
+    ahead->batch = (depth + 3) / 4;
+    ahead->job_slot = (int *)malloc(list->count * sizeof(int));
+    ahead->slots = (read_ahead_slot *)calloc(depth, sizeof(read_ahead_slot));
+    ahead->free_slots = (int *)malloc(depth * sizeof(int));
+    if (!ahead->job_slot || !ahead->slots || !ahead->free_slots) {
+        printf("Not enough memory to allocate %zu bytes.", list->count * sizeof(int));
+        exit(-3);
     }
+    for (size_t i = 0; i < list->count; ++i) ahead->job_slot[i] = READ_AHEAD_NONE;
+    // the slots are used from 0, the first files fill the ring in walk order
+    for (int i = 0; i < depth; ++i) ahead->free_slots[i] = depth - 1 - i;
+    ahead->nfree = depth;
     
-    write_line("DROP TABLE IF EXISTS documentation;", -1, 1);
-    if(OPTIONS_COL){
-        write_line("CREATE VIRTUAL TABLE IF NOT EXISTS documentation USING fts5 (url, content, options);", -1, 1);
-    } else {
-        write_line("CREATE VIRTUAL TABLE IF NOT EXISTS documentation USING fts5 (url, content);", -1, 1);
+    pthread_mutex_init(&ahead->lock, NULL);
+    pthread_cond_init(&ahead->ready, NULL);
+    pthread_cond_init(&ahead->taken, NULL);
+    if (pthread_create(&ahead->thread, NULL, read_ahead_run, ahead) != 0) {
+        printf("Unable to create read-ahead thread.");
+        exit(-12);
     }
+    return true;
+    #else
+    return false;
+    #endif
 }
 
-static void create_output (const char *path) {
-#if GENERATE_SQLITE_DATABASE
-    create_database(path);
-#else
-    create_file(path);
-#endif
-}
-
-static void close_output (void) {
-#if GENERATE_SQLITE_DATABASE
-    if (db) sqlite3_close(db);
-#else
-    if (use_transaction) {
-        write_line("COMMIT;", -1, 1);
+// returns true with the file read (or at least opened) ahead, false when the parser has to read it
+static bool read_ahead_take (read_ahead *ahead, size_t job, file_prefetch *file) {
+    pthread_mutex_lock(&ahead->lock);
+    int index = ahead->job_slot[job];
+    if (index < 0) {
+        ahead->job_slot[job] = READ_AHEAD_PARSER;
+        pthread_mutex_unlock(&ahead->lock);
+        return false;
     }
-#endif
-    if (f) fclose(f);
+    
+    read_ahead_slot *slot = &ahead->slots[index];
+    ++ahead->waiting;
+    while (!slot->ready) pthread_cond_wait(&ahead->ready, &ahead->lock);
+    --ahead->waiting;
+    *file = slot->file;
+    ahead->free_slots[ahead->nfree++] = index;
+    if (ahead->nfree == ahead->batch) pthread_cond_signal(&ahead->taken);
+    pthread_mutex_unlock(&ahead->lock);
+    return true;
 }
 
+static void read_ahead_finish (read_ahead *ahead) {
+    #if ENABLE_IO_URING
+    pthread_join(ahead->thread, NULL);
+    uring_free(&ahead->ring);
+    pthread_mutex_destroy(&ahead->lock);
+    pthread_cond_destroy(&ahead->ready);
+    pthread_cond_destroy(&ahead->taken);
+    free(ahead->job_slot);
+    free(ahead->slots);
+    free(ahead->free_slots);
+    #endif
+}
 
-#if GENERATE_SQLITE_DATABASE
-static void add_database_entry(const char *url, char *buffer, size_t size) {
-    sqlite3_stmt *vm = NULL;
-    
-    int rc = sqlite3_prepare_v2(db, "INSERT INTO documentation (url, content) VALUES (?1, ?2);", -1, &vm, NULL);
-    if (rc != SQLITE_OK) goto abort_add;
-    
-    rc = sqlite3_bind_text(vm, 1, url, -1, SQLITE_STATIC);
-    if (rc != SQLITE_OK) goto abort_add;
-    
-    rc = sqlite3_bind_text(vm, 2, buffer, (int)size, SQLITE_STATIC);
-    if (rc != SQLITE_OK) goto abort_add;
+// parses the file of the job, the time waiting for the reader is counted as read
+static void process_job (const docbuilder_options *options, const manifest *previous, const doc_list *list, read_ahead *ahead, size_t job, file_scratch *scratch, doc_entry *entry) {
+    file_prefetch file = {0};
+    stats_time wait = {0, 0};
+    stats_time t = stats_now(options);
+    bool prefetched = (ahead && read_ahead_take(ahead, job, &file));
+    stats_lap(options, &wait, &t);
     
-    rc = sqlite3_step(vm);
-    if (rc != SQLITE_DONE) goto abort_add;
-    
-    sqlite3_finalize(vm);
-    
-    return;
-    
-abort_add:
-    printf("add_database error: %s\n", sqlite3_errmsg(db));
-    exit(-10);
+    process_file(options, previous, list->paths[job], scratch, (prefetched) ? &file : NULL, entry);
+    stats_time_add(&entry->stats.read, &wait);
+    free(file.data);
 }
-#endif
 
-static void add_file_entry(const char *url, char *buffer, size_t bsize, char *astro_header, size_t header_size) {
-    if (bsize == -1) bsize = strlen(buffer);
-    if (header_size == -1) header_size = strlen(astro_header);
-    
-    size_t url_size = strlen(url);
-    
-    size_t blen;
-    if(OPTIONS_COL){
-        blen = url_size + bsize + header_size + 1024;
-    } else {
-        blen = url_size + bsize + 1024;
-    }
-    char *b = malloc (blen);
-    if (!b) {
-        exit(-11);
-    }
+// a single parser: the entries are parsed and written by the main thread while the reader runs ahead
+static void process_docs_ahead (const docbuilder_options *options, docbuilder_output *output, const doc_list *list, file_scratch *scratch) {
+    read_ahead ahead;
+    bool started = read_ahead_start(&ahead, options, output->previous, list);
+    if (started) output->stats.read_ahead = ahead.depth;
     
-    size_t nwrote;
-    if(OPTIONS_COL){
-        nwrote = snprintf(b, blen, "INSERT INTO documentation (url, content, options) VALUES ('%s', '%s', json('%s'));", url, buffer, astro_header);
-    } else {
-        nwrote = snprintf(b, blen, "INSERT INTO documentation (url, content) VALUES ('%s', '%s');", url, buffer);
+    for (size_t job = 0; job < list->count; ++job) {
+        doc_entry entry;
+        process_job(options, output->previous, list, (started) ? &ahead : NULL, job, scratch, &entry);
+        write_entry(options, output, &entry);
+        free_entry(&entry);
     }
-    write_line(b, nwrote, 1);
     
-    free(b);
+    if (started) read_ahead_finish(&ahead);
 }
 
-static void add_entry(const char *url, char *buffer, size_t size, char *astro_header, size_t header_size) {
-#if GENERATE_SQLITE_DATABASE
-    add_database_entry(url, buffer, size);
-#else
-    add_file_entry(url, buffer, size, astro_header, header_size);
-#endif
+// MARK: - Thread Pool -
+
+// Files are distributed round-robin to per-worker deques, a worker pops from the front of its own
+// deque (lowest index first, so the writer can make progress) and when it runs out of work it steals
+// from the back of the other deques. Entries are written by the main thread strictly in walk order,
+// so the output is byte-identical to the single-threaded one.
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t          *jobs;
+    size_t          head;
+    size_t          tail;
+} work_queue;
+
+typedef struct {
+    const docbuilder_options    *options;
+    const manifest              *previous;
+    const doc_list              *list;
+    doc_entry                   *entries;
+    bool                        *done;
+    work_queue                  *queues;
+    int                         nqueues;
+    read_ahead                  *ahead;         // NULL when the parsers read the files
+    size_t                      written;        // next job of the writer
+    size_t                      window;         // a job can start only when it is less than written + window
+    int                         waiting;        // workers waiting for the writer
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;           // a job is done (writer) or written (workers)
+} thread_pool;
+
+typedef struct {
+    thread_pool     *pool;
+    int             index;
+} worker_context;
+
+static bool work_queue_pop (work_queue *queue, size_t *job, bool from_back) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = (from_back) ? queue->jobs[--queue->tail] : queue->jobs[queue->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
 }
 
-static void scan_docs (const char *base_url, const char *dir_path) {
-    DIRREF dir = opendir(dir_path);
-    if (!dir) return;
+static void *worker_run (void *arg) {
+    worker_context *worker = (worker_context *)arg;
+    thread_pool *pool = worker->pool;
+    file_scratch scratch = {0};
     
-    const char *target_file;
-    while ((target_file = directory_read(dir))) {
-        
-        // if file is a folder then start recursion
-        const char *full_path = file_buildpath(target_file, dir_path);
-        if (is_directory(full_path)) {
-            scan_docs(base_url, full_path);
-            continue;
+    while (1) {
+        size_t job;
+        bool found = work_queue_pop(&pool->queues[worker->index], &job, false);
+        for (int k = 1; !found && k < pool->nqueues; ++k) {
+            found = work_queue_pop(&pool->queues[(worker->index + k) % pool->nqueues], &job, true);
         }
+        // jobs are never added after start, so when every queue is empty the work is done
+        if (!found) break;
         
-        // test only files with a .md or mdx extension
-        if ((strstr(full_path, ".md") == NULL) && (strstr(full_path, ".mdx") == NULL)) continue;
+        // the parsed pages wait in memory until they are written, a worker doesn't run too far ahead of the writer
+        pthread_mutex_lock(&pool->lock);
+        while (job >= pool->written + pool->window) {
+            ++pool->waiting;
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            --pool->waiting;
+        }
+        pthread_mutex_unlock(&pool->lock);
         
-        // load md source code
-        size_t size = 0;
-        char *source_code = file_read(full_path, &size);
+        doc_entry entry;
+        process_job(pool->options, pool->previous, pool->list, pool->ahead, job, &scratch, &entry);
+        detach_entry(&entry);
         
-        size_t header_size = size;
-        char *buffer = (char *)malloc(size);
-        char *astro_header = (char *)malloc(header_size);
-        if (!buffer || !astro_header) {
-            printf("Not enough memory to allocate %zu bytes.", size > header_size ? size : header_size);
-            exit(-3);
-        }
-
-        const char *slug_path = process_md(source_code, buffer, &size, astro_header, &header_size);
+        pthread_mutex_lock(&pool->lock);
+        pool->entries[job] = entry;
+        pool->done[job] = true;
+        // the writer and the workers share the condition, a signal could wake a worker instead of the writer
+        if (pool->waiting) pthread_cond_broadcast(&pool->cond);
+        else pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    
+    file_scratch_free(&scratch);
+    return NULL;
+}
 
-        if(status_draft){
-            status_draft = false;
-            continue;
+static void process_docs_parallel (const docbuilder_options *options, docbuilder_output *output, const doc_list *list) {
+    int nthreads = options->nthreads;
+    if ((size_t)nthreads > list->count) nthreads = (list->count) ? (int)list->count : 1;
+    
+    thread_pool pool = {0};
+    pool.options = options;
+    pool.previous = output->previous;
+    pool.list = list;
+    pool.nqueues = nthreads;
+    pool.window = (size_t)nthreads * WORKER_WINDOW;
+    pool.entries = (doc_entry *)calloc(list->count + 1, sizeof(doc_entry));
+    pool.done = (bool *)calloc(list->count + 1, sizeof(bool));
+    pool.queues = (work_queue *)calloc(nthreads, sizeof(work_queue));
+    pthread_t *threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    worker_context *workers = (worker_context *)calloc(nthreads, sizeof(worker_context));
+    if (!pool.entries || !pool.done || !pool.queues || !threads || !workers) {
+        printf("Not enough memory to allocate %zu bytes.", list->count * sizeof(doc_entry));
+        exit(-3);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    
+    read_ahead ahead;
+    if (options->read_ahead > 0 && read_ahead_start(&ahead, options, output->previous, list)) {
+        pool.ahead = &ahead;
+        output->stats.read_ahead = ahead.depth;
+    }
+    
+    for (int t = 0; t < nthreads; ++t) {
+        work_queue *queue = &pool.queues[t];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->jobs = (size_t *)malloc((list->count / nthreads + 1) * sizeof(size_t));
+        if (!queue->jobs) {
+            printf("Not enough memory to allocate %zu bytes.", (list->count / nthreads + 1) * sizeof(size_t));
+            exit(-3);
         }
-
-        if(OPTIONS_COL) process_json(astro_header, &header_size);
-
-        // build url and title
-        char *url;
-        if(path_using_slug && slug_path != NULL){
-            url = malloc(strlen(base_url) + strlen(slug_path) + 1);
-            strcpy(url, base_url);
-            strcat(url, slug_path);
-        } else {
-            url = file_buildurl(base_url, full_path);
+        for (size_t job = t; job < list->count; job += nthreads) queue->jobs[queue->tail++] = job;
+    }
+    
+    for (int t = 0; t < nthreads; ++t) {
+        workers[t].pool = &pool;
+        workers[t].index = t;
+        if (pthread_create(&threads[t], NULL, worker_run, &workers[t]) != 0) {
+            printf("Unable to create worker thread %d.", t);
+            exit(-12);
         }
+    }
+    
+    // write entries in walk order as soon as they are ready
+    for (size_t job = 0; job < list->count; ++job) {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.done[job]) pthread_cond_wait(&pool.cond, &pool.lock);
+        doc_entry entry = pool.entries[job];
+        pool.written = job + 1;
+        if (pool.waiting) pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
         
-        add_entry(url, buffer, size, astro_header, header_size);
-        
-        //DEBUG
-        //printf("title: %s\n", title);
-        //printf("url:   %s\n", url);
-        //printf("%s\n", src_path);
-        //printf("%s\n", full_path);
-        //printf("INPUT:\n%s\n\n", source_code);
-        //printf("OUTPUT:\n%s\n", buffer);
-        
-        free((void *)url);
-        free((void *)full_path);
-        free((void *)slug_path);
-        free(source_code);
-        free(buffer);
-        free(astro_header);
+        write_entry(options, output, &entry);
+        free_entry(&entry);
     }
+    
+    // other workers can still be stealing from any queue until every thread is joined
+    for (int t = 0; t < nthreads; ++t) pthread_join(threads[t], NULL);
+    if (pool.ahead) read_ahead_finish(pool.ahead);
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_mutex_destroy(&pool.queues[t].lock);
+        free(pool.queues[t].jobs);
+    }
+    
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+    free(pool.entries);
+    free(pool.done);
+    free(pool.queues);
+    free(threads);
+    free(workers);
 }
 
 // MARK: -
@@ -773,6 +5076,254 @@ int main (int argc, char * argv[]) {
             .description = "JSON mode"
         },
         
+        {
+            .identifier = 'T',
+            .access_letters = "T",
+            .access_name = "threads",
+            .value_name = "N",
+            .description = "Number of parser threads (0 uses every available core)"
+        },
+        
+        {
+            .identifier = 'I',
+            .access_letters = "I",
+            .access_name = "incremental",
+            .value_name = "manifest_path",
+            .description = "Emit only the changes since the run that wrote manifest_path"
+        },
+        
+        {
+            .identifier = 'M',
+            .access_letters = "M",
+            .access_name = "mmap",
+            .value_name = NULL,
+            .description = "Memory map the input files instead of reading them"
+        },
+        
+        {
+            .identifier = 'L',
+            .access_letters = "L",
+            .access_name = "stream-threshold",
+            .value_name = "BYTES",
+            .description = "Pages larger than BYTES are parsed in chunks while they are written (default 32MB)"
+        },
+        
+        {
+            .identifier = 'R',
+            .access_letters = "R",
+            .access_name = "batch-rows",
+            .value_name = "N",
+            .description = "Pages inserted by each INSERT statement of the sql format (default 1)"
+        },
+        
+        {
+            .identifier = 'B',
+            .access_letters = "B",
+            .access_name = "batch-bytes",
+            .value_name = "BYTES",
+            .description = "Maximum size of a multi-row INSERT statement (default 1MB)"
+        },
+        
+        {
+            .identifier = 'U',
+            .access_letters = "U",
+            .access_name = "upload",
+            .value_name = "URL",
+            .description = "Post the statements to the weblite sql endpoint at URL (token in $DOCBUILDER_TOKEN)"
+        },
+        
+        {
+            .identifier = 'D',
+            .access_letters = "D",
+            .access_name = "database",
+            .value_name = "NAME",
+            .description = "Database used by the uploaded statements or by the weblite request body"
+        },
+        
+        {
+            .identifier = 'Q',
+            .access_letters = "Q",
+            .access_name = "upload-bytes",
+            .value_name = "BYTES",
+            .description = "Size of each uploaded request (default 4MB)"
+        },
+        
+        {
+            .identifier = 'P',
+            .access_letters = "P",
+            .access_name = "upload-pipeline",
+            .value_name = "N",
+            .description = "Requests sent without waiting for their response (default 4)"
+        },
+        
+        {
+            .identifier = 'F',
+            .access_letters = "F",
+            .access_name = "format",
+            .value_name = "sql|sqlite|weblite-json",
+            .description = "Write the SQL statements (default), build the sqlite database or write the weblite request body"
+        },
+        
+        {
+            .identifier = 'H',
+            .access_letters = "H",
+            .access_name = "split-sections",
+            .value_name = NULL,
+            .description = "Write a row for each #, ## and ### section of a page, with its url#anchor and section_title"
+        },
+        
+        {
+            .identifier = 'N',
+            .access_letters = NULL,
+            .access_name = "fts-unindexed",
+            .value_name = "url,options,...",
+            .description = "Columns stored but not indexed by the FTS5 table"
+        },
+        
+        {
+            .identifier = 'f',
+            .access_letters = NULL,
+            .access_name = "fts-front-matter",
+            .value_name = "title,description,...",
+            .description = "Front matter keys copied to their own columns (needs --use-front-matter), a list is written as its items"
+        },
+        
+        {
+            .identifier = 'w',
+            .access_letters = NULL,
+            .access_name = "fts-weights",
+            .value_name = "title:10,...",
+            .description = "Weights of the columns in the bm25 rank (default 1), ORDER BY rank uses them"
+        },
+        
+        {
+            .identifier = 'X',
+            .access_letters = NULL,
+            .access_name = "fts-prefix",
+            .value_name = "2,3,...",
+            .description = "Prefix indexes of the FTS5 table, for type-ahead queries"
+        },
+        
+        {
+            .identifier = 'd',
+            .access_letters = NULL,
+            .access_name = "fts-detail",
+            .value_name = "full|column|none",
+            .description = "Detail of the FTS5 index, column and none are smaller but have no phrase and NEAR queries and a slower bm25"
+        },
+        
+        {
+            .identifier = 'z',
+            .access_letters = NULL,
+            .access_name = "fts-columnsize",
+            .value_name = "0|1",
+            .description = "Store the size of each column (default 1), 0 makes bm25 slower"
+        },
+        
+        {
+            .identifier = 'k',
+            .access_letters = NULL,
+            .access_name = "fts-tokenizer",
+            .value_name = "tokenizer",
+            .description = "Tokenizer of the FTS5 table, like porter unicode61 or trigram"
+        },
+        
+        {
+            .identifier = 'C',
+            .access_letters = NULL,
+            .access_name = "fts-content",
+            .value_name = "internal|external|contentless",
+            .description = "Where the text of the rows is stored (default internal), contentless has no snippets"
+        },
+        
+        {
+            .identifier = 'A',
+            .access_letters = NULL,
+            .access_name = "fts-automerge",
+            .value_name = "N",
+            .description = "FTS5 automerge setting written after the load"
+        },
+        
+        {
+            .identifier = 'Y',
+            .access_letters = NULL,
+            .access_name = "fts-crisismerge",
+            .value_name = "N",
+            .description = "FTS5 crisismerge setting written after the load"
+        },
+        
+        {
+            .identifier = 'G',
+            .access_letters = NULL,
+            .access_name = "fts-pgsz",
+            .value_name = "bytes",
+            .description = "FTS5 page size written after the load"
+        },
+        
+        {
+            .identifier = 'O',
+            .access_letters = NULL,
+            .access_name = "fts-optimize",
+            .value_name = NULL,
+            .description = "Merge the FTS5 index into a single segment at the end of the sql file (always done by the sqlite format)"
+        },
+        
+        {
+            .identifier = 'E',
+            .access_letters = NULL,
+            .access_name = "dedup",
+            .value_name = NULL,
+            .description = "Index the pages with the same text once, their other urls are written to documentation_urls"
+        },
+        
+        {
+            .identifier = 'W',
+            .access_letters = NULL,
+            .access_name = "stats",
+            .value_name = "file.json",
+            .description = "Write the time of each phase, the files skipped, the largest and slowest files and the peak memory to a json file"
+        },
+        
+        {
+            .identifier = 'V',
+            .access_letters = NULL,
+            .access_name = "sort",
+            .value_name = NULL,
+            .description = "Walk the folders in name order, the output is the same on every file system"
+        },
+        
+        {
+            .identifier = 'K',
+            .access_letters = NULL,
+            .access_name = "read-ahead",
+            .value_name = "N",
+            .description = "Files opened and read with io_uring ahead of the parsers (default 0, the parsers read them)"
+        },
+        
+        {
+            .identifier = 'J',
+            .access_letters = NULL,
+            .access_name = "autocomplete",
+            .value_name = NULL,
+            .description = "Write the page titles and the headings to the documentation_autocomplete table, with normalized prefix keys and a score"
+        },
+        
+        {
+            .identifier = 'Z',
+            .access_letters = NULL,
+            .access_name = "compress",
+            .value_name = "gzip|zstd[:level]",
+            .description = "Compress the sql file while it is written and send the uploaded requests compressed"
+        },
+        
+        {
+            .identifier = 'S',
+            .access_letters = "S",
+            .access_name = "simd",
+            .value_name = "auto|avx2|sse2|scalar",
+            .description = "Instruction set used to scan the text (default auto)"
+        },
+        
         {
             .identifier = 'h',
             .access_letters = "h",
@@ -783,23 +5334,69 @@ int main (int argc, char * argv[]) {
         
     };
     
+    docbuilder_options opt = {0};
+    const char *simd = NULL;
+    const char *format = NULL;
+    opt.nthreads = 1;
+    opt.stream_threshold = DEFAULT_STREAM_THRESHOLD;
+    opt.batch_rows = 1;
+    opt.batch_bytes = DEFAULT_BATCH_BYTES;
+    opt.upload_bytes = DEFAULT_UPLOAD_BYTES;
+    opt.upload_depth = DEFAULT_UPLOAD_DEPTH;
+    opt.fts_columnsize = true;
+    opt.fts_automerge = opt.fts_crisismerge = opt.fts_pgsz = -1;
+    const char *fts_content = NULL;
+    const char *fts_front_matter = NULL;
+    const char *compress = NULL;
+    
     cag_option_context context;
     cag_option_init(&context, options, CAG_ARRAY_SIZE(options), argc, argv);
     
     while (cag_option_fetch(&context)) {
         switch (cag_option_get_identifier(&context)) {
-            case 'i': src_path = cag_option_get_value(&context); break;
-            case 'o': dest_path = cag_option_get_value(&context); break;
-            case 'b': base_url = cag_option_get_value(&context); break;
-            case 'l': strip_html = true; break;
-            case 'j': strip_jsx = true; break;
-            case 'm': strip_md_title = true; break;
-            case 'a': use_front_matter = true; break;
-            case 't': use_transaction = true; break;
-            case 'u': use_database = true; break;
-            case 's': json_mode = true; break;
-            case 'g': path_using_slug = true; break;
-            case 'c': create_db = true; break;
+            case 'i': opt.src_path = cag_option_get_value(&context); break;
+            case 'o': opt.dest_path = cag_option_get_value(&context); break;
+            case 'b': opt.base_url = cag_option_get_value(&context); break;
+            case 'l': opt.strip_html = true; break;
+            case 'j': opt.strip_jsx = true; break;
+            case 'm': opt.strip_md_title = true; break;
+            case 'a': opt.use_front_matter = true; break;
+            case 't': opt.use_transaction = true; break;
+            case 'u': opt.use_database = true; break;
+            case 's': opt.json_mode = true; break;
+            case 'g': opt.path_using_slug = true; break;
+            case 'c': opt.create_db = true; break;
+            case 'M': opt.use_mmap = true; break;
+            case 'L': opt.stream_threshold = (cag_option_get_value(&context)) ? strtoull(cag_option_get_value(&context), NULL, 10) : opt.stream_threshold; break;
+            case 'I': opt.incremental_path = cag_option_get_value(&context); break;
+            case 'R': opt.batch_rows = (cag_option_get_value(&context)) ? strtoull(cag_option_get_value(&context), NULL, 10) : opt.batch_rows; break;
+            case 'B': opt.batch_bytes = (cag_option_get_value(&context)) ? strtoull(cag_option_get_value(&context), NULL, 10) : opt.batch_bytes; break;
+            case 'U': opt.upload_url = cag_option_get_value(&context); break;
+            case 'D': opt.database = cag_option_get_value(&context); break;
+            case 'Q': opt.upload_bytes = (cag_option_get_value(&context)) ? strtoull(cag_option_get_value(&context), NULL, 10) : opt.upload_bytes; break;
+            case 'P': opt.upload_depth = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : opt.upload_depth; break;
+            case 'F': format = cag_option_get_value(&context); break;
+            case 'H': opt.split_sections = true; break;
+            case 'N': opt.fts_unindexed = cag_option_get_value(&context); break;
+            case 'f': fts_front_matter = cag_option_get_value(&context); break;
+            case 'w': opt.fts_weights = cag_option_get_value(&context); break;
+            case 'X': opt.fts_prefix = cag_option_get_value(&context); break;
+            case 'd': opt.fts_detail = cag_option_get_value(&context); break;
+            case 'z': opt.fts_columnsize = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) != 0 : opt.fts_columnsize; break;
+            case 'k': opt.fts_tokenizer = cag_option_get_value(&context); break;
+            case 'C': fts_content = cag_option_get_value(&context); break;
+            case 'A': opt.fts_automerge = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : opt.fts_automerge; break;
+            case 'Y': opt.fts_crisismerge = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : opt.fts_crisismerge; break;
+            case 'G': opt.fts_pgsz = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : opt.fts_pgsz; break;
+            case 'O': opt.fts_optimize = true; break;
+            case 'E': opt.dedup = true; break;
+            case 'W': opt.stats_path = cag_option_get_value(&context); break;
+            case 'V': opt.sort_walk = true; break;
+            case 'K': opt.read_ahead = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : opt.read_ahead; break;
+            case 'Z': compress = cag_option_get_value(&context); break;
+            case 'J': opt.autocomplete = true; break;
+            case 'S': simd = cag_option_get_value(&context); break;
+            case 'T': opt.nthreads = (cag_option_get_value(&context)) ? atoi(cag_option_get_value(&context)) : 0; break;
                 
             case 'h':
                 printf("Usage: docbuilder [OPTION]...\n");
@@ -813,9 +5410,112 @@ int main (int argc, char * argv[]) {
         }
       }
     
-    create_output(dest_path);
-    scan_docs(base_url, src_path);
-    close_output();
+    if (format && strcmp(format, "sqlite") == 0) {
+        #if ENABLE_SQLITE_OUTPUT
+        opt.format = FORMAT_SQLITE;
+        #else
+        printf("The sqlite format is not available, build with -DENABLE_SQLITE_OUTPUT=1 -lsqlite3.");
+        exit(-1);
+        #endif
+    } else if (format && strcmp(format, "weblite-json") == 0) {
+        opt.format = FORMAT_WEBLITE_JSON;
+        if (!opt.database) {
+            printf("The weblite-json format requires a database name.");
+            exit(-1);
+        }
+        opt.json_mode = true;
+    } else if (format && strcmp(format, "sql") != 0) {
+        printf("Unsupported output format: %s.", format);
+        exit(-1);
+    }
+    
+    if (compress && !compress_parse(compress, &opt)) {
+        printf("Unsupported compression: %s.", compress);
+        exit(-1);
+    }
+    if (opt.compress != COMPRESS_NONE && opt.format == FORMAT_SQLITE) {
+        printf("The sqlite format can't be compressed.");
+        exit(-1);
+    }
+    
+    if (opt.batch_rows == 0) opt.batch_rows = 1;
+    if (opt.upload_depth <= 0) opt.upload_depth = 1;
+    
+    if (opt.upload_url) {
+        #if ENABLE_UPLOAD
+        if (opt.format != FORMAT_SQL || !opt.database) {
+            printf("The upload requires the sql format and a database name.");
+            exit(-1);
+        }
+        // the statements are sent inside a json string, escaped like the weblite-json format
+        opt.json_mode = true;
+        #else
+        printf("The upload is not available, build with -DENABLE_UPLOAD=1 -lssl -lcrypto.");
+        exit(-1);
+        #endif
+    }
+    
+    if (fts_content && strcmp(fts_content, "external") == 0) opt.fts_content = FTS_CONTENT_EXTERNAL;
+    else if (fts_content && strcmp(fts_content, "contentless") == 0) opt.fts_content = FTS_CONTENT_NONE;
+    else if (fts_content && strcmp(fts_content, "internal") != 0) {
+        printf("Unsupported FTS5 content: %s.", fts_content);
+        exit(-1);
+    }
+    if (fts_front_matter && !opt.use_front_matter) {
+        printf("--fts-front-matter requires --use-front-matter.");
+        exit(-1);
+    }
+    char *fm_keys = (fts_front_matter) ? strdup(fts_front_matter) : NULL;
+    if (fm_keys && !front_matter_columns_parse(&opt, fm_keys)) exit(-1);
+    char *columns = table_columns(&opt);
+    opt.columns = columns;
+    if (!fts_options_valid(&opt)) exit(-1);
+    
+    // values bound to the database are not escaped, the weblite request body escapes every layer at once
+    opt.sql_escape = (opt.format != FORMAT_SQLITE);
+    opt.json_escape = (opt.format != FORMAT_SQLITE && opt.json_mode);
+    opt.json_strict = (opt.format == FORMAT_WEBLITE_JSON || opt.upload_url);
+    
+    if (!md_scanner_init(simd)) {
+        printf("Unsupported SIMD instruction set: %s.", simd);
+        exit(-1);
+    }
+    
+    if (opt.nthreads <= 0) {
+        long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+        opt.nthreads = (ncores > 0) ? (int)ncores : 1;
+    }
+    
+    docbuilder_output output = {0};
+    output.stats.start = stats_now(&opt);
+    file_scratch scratch = {0};
+    scratch_buffer path = {0};
+    size_t path_len = strlen(opt.src_path);
+    memcpy(scratch_reserve(&path, path_len + 1), opt.src_path, path_len + 1);
+    
+    if (opt.incremental_path) output.previous = manifest_load(opt.incremental_path, manifest_fingerprint(&opt));
+    stats_time t = stats_now(&opt);
+    create_output(&opt, &output, opt.dest_path);
+    stats_lap(&opt, &output.stats.write, &t);
+    // the files are read ahead in the order of the walk list
+    if (opt.nthreads == 1 && opt.read_ahead <= 0) {
+        scan_docs(&opt, &output, NULL, &scratch, &path, path_len);
+    } else {
+        doc_list list = {0};
+        scan_docs(&opt, &output, &list, &scratch, &path, path_len);
+        if (opt.nthreads == 1) process_docs_ahead(&opt, &output, &list, &scratch);
+        else process_docs_parallel(&opt, &output, &list);
+        doc_list_free(&list);
+    }
+    t = stats_now(&opt);
+    remove_deleted_entries(&opt, &output);
+    stats_lap(&opt, &output.stats.write, &t);
+    close_output(&opt, &output);
+    stats_write(&opt, &output);
+    file_scratch_free(&scratch);
+    scratch_free(&path);
+    free(columns);
+    free(fm_keys);
     
     return 0;
 }